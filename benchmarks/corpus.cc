@@ -0,0 +1,120 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "corpus.hh"
+
+// Entry lengths, in characters, are picked from one of these ranges
+// with the given weight out of 100.  Everything is done in integers so
+// that no libm difference can change a corpus.
+struct LengthBucket {
+  int weight;
+  int shortest;
+  int longest;
+};
+
+static const LengthBucket lengthBuckets[] = {
+  { 25, 16, 60 },
+  { 40, 60, 160 },
+  { 22, 160, 400 },
+  { 10, 400, 1000 },
+  { 3, 1000, 3000 }
+};
+
+static const char *const words[] = {
+  "the", "of", "and", "a", "to", "in", "is", "you", "that", "it",
+  "he", "was", "for", "on", "are", "as", "with", "his", "they", "I",
+  "at", "be", "this", "have", "from", "or", "one", "had", "by", "word",
+  "but", "not", "what", "all", "were", "we", "when", "your", "can", "said",
+  "fortune", "cookie", "wisdom", "never", "always", "tomorrow", "luck",
+  "programmer", "computer", "bug", "feature", "coffee", "cat", "mountain",
+  "river", "philosophy", "beware", "friend", "money", "time", "love",
+  "naïve", "café", "Zürich", "façade", "smörgåsbord", "déjà", "vu",
+  "おみくじ", "大吉", "凶", "Ελλάδα", "мир", "😀"
+};
+
+static const char *const authors[] = {
+  "Mark Twain", "Anonymous", "Confucius", "Oscar Wilde",
+  "Murphy", "Ambrose Bierce", "Dorothy Parker", "Yogi Berra"
+};
+
+// Lines are broken at about this many characters.
+const int lineWidth = 72;
+
+CorpusGenerator::CorpusGenerator(quint32 seed) : rng(seed)
+{
+}
+
+int CorpusGenerator::entryLength()
+{
+  int pick = rng.bounded(100);
+  for (const LengthBucket &bucket : lengthBuckets) {
+    if (pick < bucket.weight)
+      return rng.bounded(bucket.shortest, bucket.longest);
+    pick -= bucket.weight;
+  }
+  return lengthBuckets[0].shortest;
+}
+
+QString CorpusGenerator::nextEntry()
+{
+  const int wordCount = sizeof(words) / sizeof(words[0]);
+  const int authorCount = sizeof(authors) / sizeof(authors[0]);
+  int length = entryLength();
+  QString entry;
+  entry.reserve(length + lineWidth);
+  int column = 0;
+  bool startSentence = true;
+
+  while (entry.size() < length) {
+    QString word = QString::fromUtf8(words[rng.bounded(wordCount)]);
+    if (startSentence && word.at(0).isLower())
+      word[0] = word.at(0).toUpper();
+    startSentence = false;
+    if (column + word.size() >= lineWidth) {
+      entry += '\n';
+      column = 0;
+    } else if (column > 0) {
+      entry += ' ';
+      column++;
+    }
+    entry += word;
+    column += word.size();
+    // End a sentence now and again.
+    if (rng.bounded(10) == 0) {
+      entry += (rng.bounded(4) == 0) ? '?' : '.';
+      column++;
+      startSentence = true;
+    }
+  }
+  if (!startSentence)
+    entry += '.';
+
+  // About one in five gets an attribution.
+  if (rng.bounded(5) == 0)
+    entry += QStringLiteral("\n\t\t-- ") + QString::fromUtf8(authors[rng.bounded(authorCount)]);
+  return entry;
+}
+
+QStringList CorpusGenerator::entries(int count)
+{
+  QStringList list;
+  list.reserve(count);
+  for (int i = 0; i < count; i++)
+    list.append(nextEntry());
+  return list;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CORPUS_HH
+#define CORPUS_HH
+
+#include <QString>
+#include <QStringList>
+#include <QRandomGenerator>
+
+// Makes up fortunes for benchmarking.  The same seed always gives the
+// same entries, on any platform, so a corpus never has to be kept
+// around: it can be made again from its seed and size.  Entry lengths
+// follow the rough shape of the fortune databases, mostly one or two
+// lines with a long tail of essays, and some of the words are not
+// ASCII so that the UTF-8 paths get a workout.
+class CorpusGenerator
+{
+public:
+  static const quint32 defaultSeed = 20120219;
+
+  explicit CorpusGenerator(quint32 seed = defaultSeed);
+  QString nextEntry();
+  QStringList entries(int count);
+
+private:
+  QRandomGenerator rng;
+  int entryLength();
+};
+
+#endif
@@ -0,0 +1,184 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QLocalSocket>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <QList>
+#include <algorithm>
+#include "fortuneprotocol.hh"
+
+// Puts load on a fortune server (omiquji --serve) from a number of
+// connections at once, each on its own thread, and reports how many
+// requests it answered a second and how long they took.  A connection
+// can keep several requests in flight, as a busy client would.
+
+struct ConnectionResult {
+  QList<qint64> latencies;
+  qint64 bytes = 0;
+  qint64 errors = 0;
+  QString failure;
+};
+
+static void runConnection(const QString &name, FortuneCommand command,
+                          quint32 corpus, int requests, int pipeline,
+                          ConnectionResult *result)
+{
+  QLocalSocket socket;
+  socket.connectToServer(name);
+  if (!socket.waitForConnected(5000)) {
+    result->failure = socket.errorString();
+    return;
+  }
+
+  char request[fortuneMessageSize];
+  storeFortuneRequest(request, command, corpus, 0);
+  QList<qint64> sentAt;
+  QElapsedTimer clock;
+  clock.start();
+  result->latencies.reserve(requests);
+  int sent = 0;
+  int answered = 0;
+  // Bytes still to come of the payload being read.
+  qint64 pending = 0;
+
+  while (answered < requests) {
+    while (sent < requests && sent - answered < pipeline) {
+      socket.write(request, sizeof(request));
+      sentAt.append(clock.nsecsElapsed());
+      sent++;
+    }
+    socket.flush();
+    if (!socket.bytesAvailable() && !socket.waitForReadyRead(5000)) {
+      result->failure = socket.errorString();
+      return;
+    }
+    for (;;) {
+      if (pending) {
+        qint64 skipped = socket.skip(pending);
+        if (skipped <= 0)
+          break;
+        pending -= skipped;
+        if (pending)
+          break;
+        result->latencies.append(clock.nsecsElapsed() - sentAt.at(answered));
+        answered++;
+        continue;
+      }
+      if (socket.bytesAvailable() < fortuneMessageSize)
+        break;
+      char reply[fortuneMessageSize];
+      quint32 value, length;
+      socket.read(reply, sizeof(reply));
+      readFortuneMessage(reply, &value, &length);
+      if (value == replyError)
+        result->errors++;
+      result->bytes += length;
+      pending = length;
+      if (!pending) {
+        result->latencies.append(clock.nsecsElapsed() - sentAt.at(answered));
+        answered++;
+      }
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("fortuneload");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Puts load on an omiquji fortune server.");
+  parser.addHelpOption();
+  QCommandLineOption connectionsOption(QStringList() << "c" << "connections",
+    "Connections to make, each on its own thread.", "count",
+    QString::number(qMax(1, QThread::idealThreadCount())));
+  parser.addOption(connectionsOption);
+  QCommandLineOption requestsOption(QStringList() << "n" << "requests",
+    "Requests to send on each connection.", "count", "100000");
+  parser.addOption(requestsOption);
+  QCommandLineOption pipelineOption(QStringList() << "p" << "pipeline",
+    "Requests to keep in flight on each connection.", "count", "1");
+  parser.addOption(pipelineOption);
+  QCommandLineOption corpusOption("corpus",
+    "Number of the corpus to ask for.", "number", "0");
+  parser.addOption(corpusOption);
+  QCommandLineOption countOption("count",
+    "Ask for the count rather than a random fortune.");
+  parser.addOption(countOption);
+  parser.addPositionalArgument("name", "The server's socket name.");
+  parser.process(app);
+
+  if (parser.positionalArguments().count() != 1)
+    parser.showHelp(1);
+  QString name = parser.positionalArguments().at(0);
+  int connections = qMax(1, parser.value(connectionsOption).toInt());
+  int requests = qMax(1, parser.value(requestsOption).toInt());
+  int pipeline = qMax(1, parser.value(pipelineOption).toInt());
+  quint32 corpus = parser.value(corpusOption).toUInt();
+  FortuneCommand command = parser.isSet(countOption) ? CommandCount : CommandRandom;
+
+  QList<ConnectionResult> results(connections);
+  QList<QThread*> threads;
+  QElapsedTimer clock;
+  clock.start();
+  for (int i = 0; i < connections; i++) {
+    ConnectionResult *result = &results[i];
+    threads.append(QThread::create(runConnection, name, command, corpus,
+                                   requests, pipeline, result));
+    threads.last()->start();
+  }
+  for (QThread *thread : threads) {
+    thread->wait();
+    delete thread;
+  }
+  qint64 elapsed = clock.nsecsElapsed();
+
+  QTextStream out(stdout);
+  QList<qint64> latencies;
+  qint64 bytes = 0, errors = 0;
+  for (const ConnectionResult &result : results) {
+    if (!result.failure.isEmpty()) {
+      QTextStream(stderr) << "fortuneload: " << result.failure << Qt::endl;
+      return 1;
+    }
+    latencies += result.latencies;
+    bytes += result.bytes;
+    errors += result.errors;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](int p) {
+    return latencies.at(qMin<qsizetype>(latencies.count() - 1,
+                                        latencies.count() * p / 100)) / 1000.0;
+  };
+
+  // One key=value line, for scripts to keep and compare.
+  out << "requests=" << latencies.count()
+      << " errors=" << errors
+      << " seconds=" << elapsed / 1e9
+      << " per_second=" << qRound64(latencies.count() / (elapsed / 1e9))
+      << " bytes=" << bytes
+      << " p50_us=" << percentile(50)
+      << " p99_us=" << percentile(99)
+      << " max_us=" << latencies.last() / 1000.0 << Qt::endl;
+  return 0;
+}
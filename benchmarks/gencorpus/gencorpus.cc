@@ -0,0 +1,144 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QSaveFile>
+#include <QTextStream>
+#include <climits>
+#include "corpus.hh"
+#include "omiformat.hh"
+
+// Writes a corpus of fortunes as a strfile, or as an .omi file when
+// the output name ends in .omi.  Entries are made and written one at
+// a time, so even the ten million entry corpora do not have to fit in
+// memory.
+
+static bool writeStrfile(QSaveFile &file, quint32 seed, qint64 count)
+{
+  CorpusGenerator generator(seed);
+  for (qint64 i = 0; i < count; i++) {
+    QByteArray entry = generator.nextEntry().toUtf8();
+    entry.append("\n%\n");
+    if (file.write(entry) != entry.size())
+      return false;
+  }
+  return true;
+}
+
+static bool writeOmifile(QSaveFile &file, quint32 seed, qint64 count)
+{
+  // The table comes before the payloads, so go through the corpus
+  // twice: once for the lengths and once for the text.  The lengths
+  // also say whether the file needs 64-bit offsets.
+  const qint64 tableBlock = 512;
+  CorpusGenerator lengths(seed);
+  QList<quint32> sizes;
+  sizes.reserve(count);
+  qint64 payloadBytes = 0;
+  for (qint64 i = 0; i < count; i++) {
+    sizes.append(lengths.nextEntry().toUtf8().size());
+    payloadBytes += sizes.last();
+  }
+  bool wide = !fitsNarrowOffsets(omikujiHeaderSize(false)
+                                 + count * tableEntrySize(false) + payloadBytes);
+  qint64 entrySize = tableEntrySize(wide);
+  quint64 offset = omikujiHeaderSize(wide) + count * entrySize;
+
+  OmikujiHeader header;
+  char stored[maxOmikujiHeaderSize];
+  fillOmikujiHeader(&header, (wide) ? omikuji_wide_version : omikuji_version,
+                    { 0, 0 },
+                    { static_cast<quint64>(omikujiHeaderSize(wide)),
+                      static_cast<quint32>(count) });
+  qint64 headerSize = storeOmikujiHeader(stored, header);
+  if (file.write(stored, headerSize) != headerSize)
+    return false;
+
+  QByteArray table;
+  table.reserve(tableBlock * entrySize);
+  for (qint64 i = 0; i < count; i++) {
+    char entry[maxTableEntrySize];
+    table.append(entry, storeTableEntry(entry, { offset, sizes.at(i) }, wide));
+    offset += sizes.at(i);
+    if (table.size() == tableBlock * entrySize || i == count - 1) {
+      if (file.write(table) != table.size())
+        return false;
+      table.clear();
+    }
+  }
+
+  CorpusGenerator payloads(seed);
+  for (qint64 i = 0; i < count; i++) {
+    QByteArray entry = payloads.nextEntry().toUtf8();
+    if (file.write(entry) != entry.size())
+      return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("gencorpus");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Makes up a corpus of fortunes for benchmarking.");
+  parser.addHelpOption();
+  QCommandLineOption seedOption(QStringList() << "s" << "seed",
+    "Seed for the generator.", "seed",
+    QString::number(CorpusGenerator::defaultSeed));
+  parser.addOption(seedOption);
+  parser.addPositionalArgument("entries", "How many fortunes to make, 1K to 10M.");
+  parser.addPositionalArgument("output", "File to write, an .omi file or a strfile.");
+  parser.process(app);
+
+  QStringList args = parser.positionalArguments();
+  if (args.count() != 2)
+    parser.showHelp(1);
+
+  // Allow 1K, 10M and so on.
+  QString size = args.at(0).toUpper();
+  qint64 scale = 1;
+  if (size.endsWith('K'))
+    scale = 1000;
+  else if (size.endsWith('M'))
+    scale = 1000000;
+  if (scale > 1)
+    size.chop(1);
+  bool countOk = false, seedOk = false;
+  qint64 count = size.toLongLong(&countOk) * scale;
+  quint32 seed = parser.value(seedOption).toUInt(&seedOk);
+  if (!countOk || !seedOk || count <= 0 || count > INT_MAX) {
+    QTextStream(stderr) << "gencorpus: bad entry count or seed\n";
+    return 1;
+  }
+
+  QSaveFile file(args.at(1));
+  if (!file.open(QIODevice::WriteOnly)) {
+    QTextStream(stderr) << "gencorpus: " << file.errorString() << "\n";
+    return 1;
+  }
+  bool written = args.at(1).endsWith(".omi")
+    ? writeOmifile(file, seed, count) : writeStrfile(file, seed, count);
+  if (!written || !file.commit()) {
+    QTextStream(stderr) << "gencorpus: could not write " << args.at(1) << "\n";
+    return 1;
+  }
+  return 0;
+}
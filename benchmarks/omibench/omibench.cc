@@ -0,0 +1,482 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QtTest>
+#include <QTemporaryDir>
+#include <QHash>
+#include <QSet>
+#include <climits>
+#include "corpus.hh"
+#include "omidoc.hh"
+#include "omilistmodel.hh"
+#include "trigramindex.hh"
+#include "omisearch.hh"
+#include "fortunepicker.hh"
+#include "omiverify.hh"
+#include "omimerge.hh"
+#include "omisplit.hh"
+#include "strfileindex.hh"
+
+// Benchmarks for loading, saving, showing and searching documents.
+// Each one runs over generated corpora of 1K entries and up, as far as
+// OMIBENCH_MAX_ENTRIES (100K unless set; 10M at most).  The corpora
+// are made again from the same seed on every run, so the numbers can
+// be compared from one release to the next.
+class OmiBench : public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void initTestCase();
+  void readOmifile_data() { corpusSizes(); }
+  void readOmifile();
+  void mapOmifile_data() { corpusSizes(); }
+  void mapOmifile();
+  void readStrfile_data() { corpusSizes("indexed", "scan", "indexed"); }
+  void readStrfile();
+  void writeOmifile_data() { corpusSizes(); }
+  void writeOmifile();
+  void writeStrfile_data() { corpusSizes(); }
+  void writeStrfile();
+  void populateList_data() { corpusSizes(); }
+  void populateList();
+  void findNext_data();
+  void findNext();
+  void findAll_data() { corpusSizes(); }
+  void findAll();
+  void pick_data() { corpusSizes(); }
+  void pick();
+  void pickByLength_data() { corpusSizes(); }
+  void pickByLength();
+  void contains_data() { corpusSizes("indexed", "scan", "indexed"); }
+  void contains();
+  void verify_data() { corpusFormats(); }
+  void verify();
+  void merge_data() { corpusSizes("sorted", "concatenated", "sorted"); }
+  void merge();
+  void split_data() { corpusSizes("hashed", "bytes", "hash"); }
+  void split();
+  void reload_data() { corpusFormats(); }
+  void reload();
+
+private:
+  QTemporaryDir dir;
+  QList<int> sizes;
+  QHash<int, QStringList> corpora;
+  void corpusSizes();
+  void corpusSizes(const char*, const char*, const char*);
+  void corpusFormats();
+  const QStringList &corpus(int);
+  QString corpusFile(int, const QString&, bool indexed = false);
+  void fillDoc(OmiDoc&, int);
+};
+
+// Something that never turns up in a generated entry, so that every
+// search has to go through the whole section.
+static const QString missingText = QStringLiteral("quixotic");
+
+static QString sizeName(int size)
+{
+  return (size >= 1000000) ? QString("%1M").arg(size / 1000000)
+    : QString("%1K").arg(size / 1000);
+}
+
+void OmiBench::initTestCase()
+{
+  QVERIFY(dir.isValid());
+  int maxEntries = qEnvironmentVariableIsSet("OMIBENCH_MAX_ENTRIES")
+    ? qEnvironmentVariableIntValue("OMIBENCH_MAX_ENTRIES") : 100000;
+  for (int size = 1000; size <= qMin(maxEntries, 10000000); size *= 10)
+    sizes.append(size);
+}
+
+void OmiBench::corpusSizes()
+{
+  QTest::addColumn<int>("entries");
+  for (int size : sizes)
+    QTest::newRow(qPrintable(sizeName(size))) << size;
+}
+
+// Each size twice, with a flag that is false in the first row, named
+// for off, and true in the second, named for on.
+void OmiBench::corpusSizes(const char *flag, const char *off, const char *on)
+{
+  QTest::addColumn<int>("entries");
+  QTest::addColumn<bool>(flag);
+  for (int size : sizes) {
+    QTest::newRow(qPrintable(sizeName(size) + "-" + off)) << size << false;
+    QTest::newRow(qPrintable(sizeName(size) + "-" + on)) << size << true;
+  }
+}
+
+// Each size as a strfile and as an .omi file.
+void OmiBench::corpusFormats()
+{
+  QTest::addColumn<int>("entries");
+  QTest::addColumn<QString>("suffix");
+  for (int size : sizes) {
+    QTest::newRow(qPrintable(sizeName(size) + "-strfile")) << size << QString(".txt");
+    QTest::newRow(qPrintable(sizeName(size) + "-omi")) << size << QString(".omi");
+  }
+}
+
+const QStringList &OmiBench::corpus(int entries)
+{
+  if (!corpora.contains(entries))
+    corpora.insert(entries, CorpusGenerator().entries(entries));
+  return corpora[entries];
+}
+
+QString OmiBench::corpusFile(int entries, const QString &suffix, bool indexed)
+{
+  QString filename = dir.filePath(QString("corpus-%1%2%3").arg(entries)
+                                  .arg((indexed) ? "-indexed" : "").arg(suffix));
+  if (!QFile::exists(filename)) {
+    OmiDoc doc;
+    fillDoc(doc, entries);
+    doc.setIndexed(indexed);
+    QFile file(filename);
+    if (doc.writeToFile(file) < 0)
+      return QString();
+  }
+  return filename;
+}
+
+void OmiBench::fillDoc(OmiDoc &doc, int entries)
+{
+  QStringList copy = corpus(entries);
+  doc.insertEntries(OmiDoc::Fortunes, 0, std::move(copy));
+}
+
+void OmiBench::readOmifile()
+{
+  QFETCH(int, entries);
+  QString filename = corpusFile(entries, ".omi");
+  QVERIFY(!filename.isEmpty());
+  QBENCHMARK {
+    OmiDoc doc;
+    QFile file(filename);
+    QVERIFY(doc.readFromFile(file) > 0);
+    QCOMPARE(doc.fortuneCount(), entries);
+  }
+}
+
+void OmiBench::mapOmifile()
+{
+  QFETCH(int, entries);
+  QString filename = corpusFile(entries, ".omi");
+  QVERIFY(!filename.isEmpty());
+  QBENCHMARK {
+    OmiDoc doc;
+    QVERIFY(doc.mapFromFile(filename) > 0);
+    QCOMPARE(doc.fortuneCount(), entries);
+    // Touch every entry, as a walk through the list would.
+    for (int i = 0; i < doc.fortuneCount(); i++)
+      doc.entryAt(OmiDoc::Fortunes, i);
+  }
+}
+
+void OmiBench::readStrfile()
+{
+  // Strfiles are written with a .dat index; a copy has to do without.
+  QFETCH(int, entries);
+  QFETCH(bool, indexed);
+  QString filename = corpusFile(entries, ".txt");
+  QVERIFY(!filename.isEmpty());
+  if (!indexed) {
+    QString copy = dir.filePath(QString("corpus-%1-unindexed.txt").arg(entries));
+    QVERIFY(QFile::exists(copy) || QFile::copy(filename, copy));
+    filename = copy;
+  }
+  QBENCHMARK {
+    OmiDoc doc;
+    QFile file(filename);
+    QVERIFY(doc.readFromFile(file) > 0);
+    QCOMPARE(doc.fortuneCount(), entries);
+  }
+}
+
+void OmiBench::writeOmifile()
+{
+  QFETCH(int, entries);
+  OmiDoc doc;
+  fillDoc(doc, entries);
+  QString filename = dir.filePath("out.omi");
+  QBENCHMARK {
+    // An open file always gets written out whole, never as a delta.
+    QFile file(filename);
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    QVERIFY(doc.writeToFile(file) > 0);
+  }
+}
+
+void OmiBench::writeStrfile()
+{
+  QFETCH(int, entries);
+  OmiDoc doc;
+  fillDoc(doc, entries);
+  QString filename = dir.filePath("out.txt");
+  QBENCHMARK {
+    QFile file(filename);
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    QVERIFY(doc.writeToFile(file) > 0);
+  }
+}
+
+void OmiBench::populateList()
+{
+  // Much as a strfile load fills the list: in batches, with a model
+  // following along, and the first screenful of rows asked for.
+  QFETCH(int, entries);
+  const QStringList &source = corpus(entries);
+  const int batchSize = 16384;
+  QBENCHMARK {
+    OmiDoc doc;
+    OmiListModel model(&doc, OmiDoc::Fortunes);
+    for (int first = 0; first < source.count(); first += batchSize) {
+      QStringList batch = source.mid(first, batchSize);
+      doc.insertEntries(OmiDoc::Fortunes, doc.fortuneCount(), std::move(batch));
+    }
+    for (int row = 0; row < qMin(50, model.rowCount()); row++)
+      model.data(model.index(row));
+  }
+}
+
+void OmiBench::findNext_data()
+{
+  QTest::addColumn<int>("entries");
+  QTest::addColumn<QString>("mode");
+  const char *modes[] = { "plain", "indexed", "regex" };
+  for (int size : sizes) {
+    for (const char *mode : modes) {
+      QString name = QString("%1-%2").arg(sizeName(size)).arg(mode);
+      QTest::newRow(qPrintable(name)) << size << QString(mode);
+    }
+  }
+}
+
+void OmiBench::findNext()
+{
+  // The loop from MainWindow::findNext(), for a search that finds
+  // nothing and so has to look at every entry.
+  QFETCH(int, entries);
+  QFETCH(QString, mode);
+  OmiDoc doc;
+  fillDoc(doc, entries);
+  TrigramIndex *index = nullptr;
+  if (mode == "indexed") {
+    index = new TrigramIndex(&doc, OmiDoc::Fortunes, &doc);
+    QTRY_VERIFY_WITH_TIMEOUT(index->isReady(), 600000);
+  }
+  QRegularExpression re("\\b" + missingText + "\\b",
+                        QRegularExpression::CaseInsensitiveOption);
+  re.optimize();
+
+  QBENCHMARK {
+    bool useIndex = index && index->lookup(missingText);
+    bool found = false;
+    for (int row = 0; row < doc.fortuneCount() && !found; row++) {
+      if (useIndex && !index->mayContain(row))
+        continue;
+      QString entry = doc.entryAt(OmiDoc::Fortunes, row);
+      if (mode == "regex")
+        found = entry.contains(re);
+      else
+        found = entry.contains(missingText, Qt::CaseInsensitive);
+    }
+    QVERIFY(!found);
+  }
+}
+
+void OmiBench::findAll()
+{
+  QFETCH(int, entries);
+  OmiDoc doc;
+  fillDoc(doc, entries);
+  QRegularExpression re("\\bcookie\\b", QRegularExpression::CaseInsensitiveOption);
+  QBENCHMARK {
+    OmiSearch search(doc.snapshot(OmiDoc::Fortunes), re);
+    search.setMaxMatches(INT_MAX);
+    QSignalSpy finished(&search, &OmiSearch::finished);
+    search.start();
+    QVERIFY(finished.wait(600000));
+  }
+}
+
+void OmiBench::pick()
+{
+  QFETCH(int, entries);
+  OmiDoc doc;
+  QVERIFY(doc.mapFromFile(corpusFile(entries, ".omi")) > 0);
+  FortunePicker picker(doc.snapshot(OmiDoc::Fortunes));
+  QRandomGenerator rng(CorpusGenerator::defaultSeed);
+  QBENCHMARK {
+    QVERIFY(!picker.entryAt(picker.pick(rng)).isEmpty());
+  }
+}
+
+void OmiBench::pickByLength()
+{
+  // The first pick builds the length index, so leave it out.
+  QFETCH(int, entries);
+  OmiDoc doc;
+  QVERIFY(doc.mapFromFile(corpusFile(entries, ".omi")) > 0);
+  FortunePicker picker(doc.snapshot(OmiDoc::Fortunes));
+  QRandomGenerator rng(CorpusGenerator::defaultSeed);
+  QVERIFY(picker.pick(rng, 100, 200) >= 0);
+  QBENCHMARK {
+    QVERIFY(!picker.entryAt(picker.pick(rng, 100, 200)).isEmpty());
+  }
+}
+
+void OmiBench::contains()
+{
+  // One entry that is there and one that is not, as an ingest check
+  // would ask, against a freshly mapped file each time.
+  QFETCH(int, entries);
+  QFETCH(bool, indexed);
+  QString filename = corpusFile(entries, ".omi", indexed);
+  QVERIFY(!filename.isEmpty());
+  QString present = corpus(entries).at(entries / 2);
+  QBENCHMARK {
+    OmiDoc doc;
+    QVERIFY(doc.mapFromFile(filename) > 0);
+    QCOMPARE(doc.isIndexed(), indexed);
+    QVERIFY(doc.contains(OmiDoc::Fortunes, present));
+    QVERIFY(!doc.contains(OmiDoc::Fortunes, missingText));
+  }
+}
+
+void OmiBench::verify()
+{
+  QFETCH(int, entries);
+  QFETCH(QString, suffix);
+  QString filename = corpusFile(entries, suffix);
+  QVERIFY(!filename.isEmpty());
+  // A file that passes has to read back whole, too.
+  {
+    OmiDoc doc;
+    QFile file(filename);
+    QVERIFY(doc.readFromFile(file) > 0);
+    QCOMPARE(doc.fortuneCount(), entries);
+  }
+  QBENCHMARK {
+    OmiVerifier verifier(filename);
+    QVERIFY(verifier.verify());
+    QVERIFY(verifier.problems().isEmpty());
+  }
+}
+
+void OmiBench::merge()
+{
+  // The same corpus as a strfile and as an .omi file, so that dropping
+  // repeats halves the output.  The sort is held to its smallest
+  // memory limit, to make it spill runs on the bigger corpora.
+  QFETCH(int, entries);
+  QFETCH(bool, sorted);
+  QStringList inputs = { corpusFile(entries, ".txt"), corpusFile(entries, ".omi") };
+  QVERIFY(!inputs.at(0).isEmpty() && !inputs.at(1).isEmpty());
+  QString output = dir.filePath("merged.omi");
+  const QStringList &source = corpus(entries);
+  qint64 distinct = QSet<QString>(source.cbegin(), source.cend()).count();
+  QBENCHMARK {
+    OmiMerger merger;
+    merger.setSorted(sorted);
+    merger.setDeduplicated(true);
+    merger.setMemoryLimit(16 * 1024 * 1024);
+    QCOMPARE(merger.merge(inputs, output), distinct);
+  }
+  {
+    OmiDoc merged;
+    QVERIFY(merged.mapFromFile(output) > 0);
+    QCOMPARE(merged.fortuneCount(), int(distinct));
+  }
+  QFile::remove(output);
+}
+
+void OmiBench::split()
+{
+  QFETCH(int, entries);
+  QFETCH(bool, hashed);
+  QString input = corpusFile(entries, ".omi");
+  QVERIFY(!input.isEmpty());
+  QString output = dir.filePath("shard.omi");
+  QBENCHMARK {
+    OmiSplitter splitter;
+    splitter.setPartition((hashed) ? OmiSplitter::ByHash : OmiSplitter::ByBytes);
+    QCOMPARE(splitter.split(input, output, 4), qint64(entries));
+  }
+  // Every fortune has to land in exactly one shard.
+  int shardEntries = 0;
+  for (int n = 0; n < 4; n++) {
+    OmiDoc shard;
+    QVERIFY(shard.mapFromFile(OmiSplitter::shardName(output, n)) > 0);
+    shardEntries += shard.fortuneCount();
+  }
+  QCOMPARE(shardEntries, entries);
+  for (int n = 0; n < 4; n++)
+    QFile::remove(OmiSplitter::shardName(output, n));
+}
+
+void OmiBench::reload()
+{
+  // The corpus rewritten by somebody else with one fortune changed,
+  // and taken in by a document that already has the old one.
+  QFETCH(int, entries);
+  QFETCH(QString, suffix);
+  QString original = corpusFile(entries, suffix);
+  QVERIFY(!original.isEmpty());
+  QString changed = dir.filePath(QString("changed-%1%2").arg(entries).arg(suffix));
+  {
+    OmiDoc doc;
+    fillDoc(doc, entries);
+    doc.replaceEntries(OmiDoc::Fortunes, entries / 2, { missingText });
+    QFile file(changed);
+    QVERIFY(doc.writeToFile(file) > 0);
+  }
+  QBENCHMARK {
+    OmiDoc doc;
+    if (suffix == ".omi") {
+      QVERIFY(doc.mapFromFile(original) > 0);
+    } else {
+      QFile file(original);
+      QVERIFY(doc.readFromFile(file) > 0);
+    }
+    QCOMPARE(doc.reloadFromFile(changed), 1);
+    QCOMPARE(doc.fortuneCount(), entries);
+    QCOMPARE(doc.entryAt(OmiDoc::Fortunes, entries / 2), missingText);
+  }
+  QFile::remove(changed);
+  QFile::remove(strfileIndexName(changed));
+}
+
+int main(int argc, char **argv)
+{
+  QCoreApplication app(argc, argv);
+  OmiBench bench;
+  QStringList args = app.arguments();
+  // Unless told where the results should go, print them and keep an
+  // XML copy to compare with later runs.
+  if (!args.contains("-o")) {
+    args << "-o" << "-,txt";
+    args << "-o" << "omibench.xml,xml";
+  }
+  return QTest::qExec(&bench, args);
+}
+
+#include "omibench.moc"
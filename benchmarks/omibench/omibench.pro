@@ -0,0 +1,40 @@
+# Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+
+# This file is part of omiquji.
+
+# omiquji is free software: you can redistribute it and/or modify it
+# under the terms of the Lesser GNU General Public License as published
+# by the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+
+# omiquji is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# Lesser GNU General Public License for more details.
+
+# You should have received a copy of the Lesser GNU General Public License
+# along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+TEMPLATE = app
+TARGET = omibench
+QT += testlib concurrent
+QT -= gui
+CONFIG += console
+CONFIG -= app_bundle
+DEFINES += QT_DISABLE_DEPRECATED_UP_TO=0x050F00
+
+INCLUDEPATH += .. ../../src
+
+SOURCES += omibench.cc ../corpus.cc \
+    ../../src/omidoc.cc ../../src/omiblocks.cc ../../src/strfilereader.cc \
+    ../../src/omiformat.cc \
+    ../../src/omilistmodel.cc ../../src/trigramindex.cc ../../src/omisearch.cc \
+    ../../src/fortunepicker.cc ../../src/omihashindex.cc ../../src/omiverify.cc \
+    ../../src/utf8arena.cc ../../src/omiwriter.cc ../../src/omimerge.cc \
+    ../../src/omisplit.cc ../../src/strfileindex.cc
+HEADERS += ../corpus.hh \
+    ../../src/omidoc.hh ../../src/omiblocks.hh ../../src/strfilereader.hh \
+    ../../src/omiformat.hh \
+    ../../src/omilistmodel.hh ../../src/trigramindex.hh ../../src/omisearch.hh \
+    ../../src/fortunepicker.hh ../../src/omihashindex.hh ../../src/omiverify.hh \
+    ../../src/utf8arena.hh ../../src/omiwriter.hh ../../src/omimerge.hh \
+    ../../src/omisplit.hh ../../src/strfileindex.hh
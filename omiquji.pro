@@ -6,3 +6,10 @@ TEMPLATE = subdirs
 
 # Directories
 SUBDIRS += src
+
+# The benchmarks need QtTest, so they are only built when asked for,
+# with qmake -recursive CONFIG+=benchmarks.
+benchmarks: SUBDIRS += benchmarks
+
+# So are the tests, with CONFIG+=tests; run them with make check.
+tests: SUBDIRS += tests
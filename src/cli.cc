@@ -0,0 +1,406 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cli.hh"
+#include "omidoc.hh"
+#include "fortunepicker.hh"
+#include "fortuneserver.hh"
+#include "omiverify.hh"
+#include "omimerge.hh"
+#include "omisplit.hh"
+#include <QCommandLineParser>
+#include <QTextStream>
+#include <QFile>
+#include <cstring>
+
+// Arguments that mean no window is wanted.
+static const char *const commandArguments[] = {
+  "--convert", "--merge", "--split", "--pick", "--serve", "--contains", "--verify", "-h",
+  "--help", "-v", "--version"
+};
+
+bool isCommandLine(int argc, char **argv)
+{
+  for (int i = 1; i < argc; i++)
+    for (const char *arg : commandArguments)
+      if (std::strcmp(argv[i], arg) == 0)
+        return true;
+  return false;
+}
+
+static QTextStream &err()
+{
+  static QTextStream stream(stderr);
+  return stream;
+}
+
+// Reads input into doc, mapping it if it is an .omi file.
+static bool openDoc(OmiDoc &doc, const QString &input)
+{
+  qint64 bytesRead;
+  if (input.endsWith(".omi")) {
+    bytesRead = doc.mapFromFile(input);
+  } else {
+    QFile file(input);
+    bytesRead = doc.readFromFile(file);
+  }
+  if (bytesRead < 0) {
+    err() << QCoreApplication::applicationName() << ": cannot read "
+          << input << Qt::endl;
+    return false;
+  }
+  return true;
+}
+
+static bool convertFile(const QString &input, const QString &output,
+                        bool compress, bool dedup, bool index)
+{
+  // An .omi file is mapped, so that its entries go straight from the
+  // mapping to the output and are never all held at once.
+  OmiDoc doc;
+  if (!openDoc(doc, input))
+    return false;
+
+  doc.setCompressed(compress);
+  doc.setDeduplicated(dedup);
+  doc.setIndexed(index);
+  QFile file(output);
+  if (doc.writeToFile(file) < 0) {
+    err() << QCoreApplication::applicationName() << ": cannot write "
+          << output << Qt::endl;
+    return false;
+  }
+  return true;
+}
+
+static bool pickFortune(const QString &input, qint64 minLength,
+                        qint64 maxLength)
+{
+  OmiDoc doc;
+  if (!openDoc(doc, input))
+    return false;
+
+  FortunePicker picker(doc.snapshot(OmiDoc::Fortunes));
+  int row = (minLength > 0 || maxLength >= 0)
+    ? picker.pick(*QRandomGenerator::global(), minLength, maxLength)
+    : picker.pick(*QRandomGenerator::global());
+  if (row < 0) {
+    err() << QCoreApplication::applicationName() << ": no fortune in "
+          << input << " fits" << Qt::endl;
+    return false;
+  }
+  // Fortunes usually carry their own final newline.
+  QString fortune = picker.entryAt(row);
+  QTextStream out(stdout);
+  out << fortune;
+  if (!fortune.endsWith('\n'))
+    out << '\n';
+  out.flush();
+  return true;
+}
+
+// Sets found if input holds text as a fortune.
+static bool containsFortune(const QString &input, const QString &text,
+                            bool &found)
+{
+  // Only the header and the trailer of an .omi file are read to open
+  // it, and with an index a lookup reads little more.
+  OmiDoc doc;
+  if (!openDoc(doc, input))
+    return false;
+  found = doc.contains(OmiDoc::Fortunes, text);
+  return true;
+}
+
+// Reports everything wrong with input.  With an output, also writes
+// input to it with the entries that are not UTF-8 transcoded from
+// encoding.
+static bool verifyFile(const QString &input, const QString &output,
+                       LegacyEncoding encoding)
+{
+  OmiVerifier verifier(input);
+  if (!verifier.verify()) {
+    err() << QCoreApplication::applicationName() << ": cannot read "
+          << input << Qt::endl;
+    return false;
+  }
+  for (const OmiVerifier::Problem &problem : verifier.problems()) {
+    err() << input << ": ";
+    if (problem.entry >= 0)
+      err() << ((problem.section == OmiDoc::Comments) ? "comment " : "fortune ")
+            << problem.entry << " ";
+    err() << "at byte " << problem.offset << ": " << problem.message << Qt::endl;
+  }
+
+  if (!output.isEmpty()) {
+    QFile file(output);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)
+        || verifier.transcode(file, encoding) < 0) {
+      err() << QCoreApplication::applicationName() << ": cannot transcode "
+            << input << " to " << output << Qt::endl;
+      return false;
+    }
+    // The entries it complained of are dealt with now.
+    return true;
+  }
+  return verifier.problems().isEmpty();
+}
+
+int runCommandLine(QCoreApplication &app)
+{
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+    QCoreApplication::translate("cli", "An editor for omikuji files."));
+  parser.addHelpOption();
+  parser.addVersionOption();
+  QCommandLineOption convertOption("convert",
+    QCoreApplication::translate("cli", "Convert each input to the output "
+      "after it.  Files ending in .omi are omikuji files; anything "
+      "else is a strfile."));
+  parser.addOption(convertOption);
+  QCommandLineOption compressOption("compress",
+    QCoreApplication::translate("cli", "Compress the payloads of .omi "
+      "outputs."));
+  parser.addOption(compressOption);
+  QCommandLineOption dedupOption("dedup",
+    QCoreApplication::translate("cli", "Write entries that repeat an earlier "
+      "one in .omi outputs only once.  With --merge, drop them from any "
+      "output."));
+  parser.addOption(dedupOption);
+  QCommandLineOption indexOption("index",
+    QCoreApplication::translate("cli", "Add a hash index to .omi outputs, "
+      "for --contains."));
+  parser.addOption(indexOption);
+  QCommandLineOption mergeOption("merge",
+    QCoreApplication::translate("cli", "Merge the entries of all the files "
+      "into <output>, comments first."), "output");
+  parser.addOption(mergeOption);
+  QCommandLineOption sortOption("sort",
+    QCoreApplication::translate("cli", "With --merge, sort the entries of "
+      "each section by their bytes."));
+  parser.addOption(sortOption);
+  QCommandLineOption memoryOption("memory",
+    QCoreApplication::translate("cli", "With --sort, hold about <MiB> of "
+      "entries at once and spill the rest to temporary files; the default "
+      "is 512."), "MiB", "512");
+  parser.addOption(memoryOption);
+  QCommandLineOption splitOption("split",
+    QCoreApplication::translate("cli", "Split the fortunes of the input into "
+      "<count> .omi shards named after the output, as output-0.omi and "
+      "on."), "count");
+  parser.addOption(splitOption);
+  QCommandLineOption byOption("by",
+    QCoreApplication::translate("cli", "With --split, give each shard about "
+      "the same bytes, or pick its shard by <partition> hash; the default "
+      "is bytes."), "partition", "bytes");
+  parser.addOption(byOption);
+  QCommandLineOption pickOption("pick",
+    QCoreApplication::translate("cli", "Print a fortune picked at random "
+      "from each file."));
+  parser.addOption(pickOption);
+  QCommandLineOption minLengthOption("min-length",
+    QCoreApplication::translate("cli", "Only pick fortunes of at least "
+      "<bytes> bytes."), "bytes");
+  parser.addOption(minLengthOption);
+  QCommandLineOption maxLengthOption("max-length",
+    QCoreApplication::translate("cli", "Only pick fortunes of at most "
+      "<bytes> bytes."), "bytes");
+  parser.addOption(maxLengthOption);
+  QCommandLineOption serveOption("serve",
+    QCoreApplication::translate("cli", "Serve fortunes from the .omi files "
+      "on the local socket <name>."), "name");
+  parser.addOption(serveOption);
+  QCommandLineOption threadsOption("threads",
+    QCoreApplication::translate("cli", "Answer requests on <count> threads; "
+      "the default is one per core."), "count", "0");
+  parser.addOption(threadsOption);
+  QCommandLineOption containsOption("contains",
+    QCoreApplication::translate("cli", "Print the files that hold a fortune "
+      "of exactly <text>, or of what is on standard input if it is -.  "
+      "Exits with 0 if any does, 1 if none does and 2 on errors."), "text");
+  parser.addOption(containsOption);
+  QCommandLineOption verifyOption("verify",
+    QCoreApplication::translate("cli", "Check that the files are sound and "
+      "in UTF-8, and report each bad entry."));
+  parser.addOption(verifyOption);
+  QCommandLineOption transcodeOption("transcode",
+    QCoreApplication::translate("cli", "With --verify, copy each strfile "
+      "to the output after it, converting entries that are not UTF-8 "
+      "from <encoding>, latin1 or cp1252."), "encoding");
+  parser.addOption(transcodeOption);
+  parser.addPositionalArgument("files",
+    QCoreApplication::translate("cli", "Files to work on."), "[files...]");
+  parser.process(app);
+
+  QStringList files = parser.positionalArguments();
+  if (parser.isSet(convertOption)) {
+    // Pairs of files, so that a script can do many conversions for
+    // the price of one start up.
+    if (files.isEmpty() || files.count() % 2) {
+      err() << QCoreApplication::applicationName()
+            << ": --convert needs an output for every input" << Qt::endl;
+      return 1;
+    }
+    int failed = 0;
+    for (int i = 0; i < files.count(); i += 2)
+      if (!convertFile(files.at(i), files.at(i + 1),
+                       parser.isSet(compressOption),
+                       parser.isSet(dedupOption),
+                       parser.isSet(indexOption)))
+        failed++;
+    return (failed) ? 1 : 0;
+  }
+
+  if (parser.isSet(mergeOption)) {
+    bool memoryOk;
+    qint64 memory = parser.value(memoryOption).toLongLong(&memoryOk);
+    if (files.isEmpty() || !memoryOk || memory < 16) {
+      err() << QCoreApplication::applicationName()
+            << ": --merge needs files to merge and at least 16 MiB of memory"
+            << Qt::endl;
+      return 1;
+    }
+    OmiMerger merger;
+    merger.setSorted(parser.isSet(sortOption));
+    merger.setDeduplicated(parser.isSet(dedupOption));
+    merger.setIndexed(parser.isSet(indexOption));
+    merger.setMemoryLimit(memory * 1024 * 1024);
+    if (merger.merge(files, parser.value(mergeOption)) < 0) {
+      err() << QCoreApplication::applicationName() << ": "
+            << merger.errorString() << Qt::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  if (parser.isSet(splitOption)) {
+    bool countOk;
+    int count = parser.value(splitOption).toInt(&countOk);
+    QString by = parser.value(byOption);
+    if (files.count() != 2 || !countOk || count < 1 || count > 1024
+        || (by != "bytes" && by != "hash")) {
+      err() << QCoreApplication::applicationName()
+            << ": --split needs an input, an output, a count from 1 to 1024"
+            << " and a partition of bytes or hash" << Qt::endl;
+      return 1;
+    }
+    OmiSplitter splitter;
+    splitter.setPartition((by == "hash") ? OmiSplitter::ByHash
+                          : OmiSplitter::ByBytes);
+    splitter.setIndexed(parser.isSet(indexOption));
+    if (splitter.split(files.at(0), files.at(1), count) < 0) {
+      err() << QCoreApplication::applicationName() << ": "
+            << splitter.errorString() << Qt::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  if (parser.isSet(pickOption)) {
+    bool minOk = true, maxOk = true;
+    qint64 minLength = parser.isSet(minLengthOption)
+      ? parser.value(minLengthOption).toLongLong(&minOk) : 0;
+    qint64 maxLength = parser.isSet(maxLengthOption)
+      ? parser.value(maxLengthOption).toLongLong(&maxOk) : -1;
+    if (files.isEmpty() || !minOk || !maxOk) {
+      err() << QCoreApplication::applicationName()
+            << ": --pick needs a file and whole numbers of bytes" << Qt::endl;
+      return 1;
+    }
+    int failed = 0;
+    for (const QString &file : files)
+      if (!pickFortune(file, minLength, maxLength))
+        failed++;
+    return (failed) ? 1 : 0;
+  }
+
+  if (parser.isSet(containsOption)) {
+    if (files.isEmpty()) {
+      err() << QCoreApplication::applicationName()
+            << ": --contains needs at least one file" << Qt::endl;
+      return 2;
+    }
+    QString text = parser.value(containsOption);
+    if (text == "-") {
+      QFile in;
+      if (!in.open(stdin, QIODevice::ReadOnly)) {
+        err() << QCoreApplication::applicationName()
+              << ": cannot read standard input" << Qt::endl;
+        return 2;
+      }
+      text = QString::fromUtf8(in.readAll());
+    }
+    bool anyFound = false, failed = false;
+    for (const QString &file : files) {
+      bool found = false;
+      if (!containsFortune(file, text, found))
+        failed = true;
+      if (found) {
+        QTextStream(stdout) << file << Qt::endl;
+        anyFound = true;
+      }
+    }
+    return (failed) ? 2 : (anyFound) ? 0 : 1;
+  }
+
+  if (parser.isSet(verifyOption)) {
+    bool transcoding = parser.isSet(transcodeOption);
+    QString encoding = parser.value(transcodeOption).toLower();
+    if (files.isEmpty() || (transcoding && files.count() % 2)
+        || (transcoding && encoding != "latin1" && encoding != "cp1252")) {
+      err() << QCoreApplication::applicationName()
+            << ": --verify needs files, and --transcode an output for every"
+            << " input and an encoding of latin1 or cp1252" << Qt::endl;
+      return 1;
+    }
+    LegacyEncoding legacy = (encoding == "latin1") ? LegacyEncoding::Latin1
+      : LegacyEncoding::Cp1252;
+    int failed = 0;
+    for (int i = 0; i < files.count(); i += (transcoding) ? 2 : 1)
+      if (!verifyFile(files.at(i), (transcoding) ? files.at(i + 1) : QString(),
+                      legacy))
+        failed++;
+    return (failed) ? 1 : 0;
+  }
+
+  if (parser.isSet(serveOption)) {
+    if (files.isEmpty()) {
+      err() << QCoreApplication::applicationName()
+            << ": --serve needs at least one .omi file" << Qt::endl;
+      return 1;
+    }
+    FortuneServer server;
+    for (const QString &file : files) {
+      if (!server.addCorpus(file)) {
+        err() << QCoreApplication::applicationName() << ": cannot map "
+              << file << Qt::endl;
+        return 1;
+      }
+    }
+    if (!server.start(parser.value(serveOption),
+                      parser.value(threadsOption).toInt())) {
+      err() << QCoreApplication::applicationName() << ": "
+            << server.errorString() << Qt::endl;
+      return 1;
+    }
+    return app.exec();
+  }
+
+  parser.showHelp(1);
+  return 1;
+}
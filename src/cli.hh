@@ -0,0 +1,33 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CLI_HH
+#define CLI_HH
+
+#include <QCoreApplication>
+
+// omiquji can also be run without a window, for batch jobs.  These are
+// kept apart from the GUI so that they never construct a widget and do
+// not need a display.
+
+// True if the arguments ask for one of the batch commands, in which
+// case a QCoreApplication is all that should be made.
+bool isCommandLine(int argc, char **argv);
+int runCommandLine(QCoreApplication &app);
+
+#endif
@@ -22,10 +22,19 @@
 FindDialog::FindDialog(QWidget *parent) :
   QDialog(parent),
   ui(new Ui::FindDialog),
-  options(new FindDialog::Options)
+  options(new FindDialog::Options),
+  isFindingAll(false),
+  searchedCount(0),
+  totalCount(0)
 {
   ui->setupUi(this);
   ui->extensionWidget->setVisible(false);
+  ui->resultsWidget->setVisible(false);
+  connect(ui->resultsList, &QListWidget::currentItemChanged, this,
+          [=](QListWidgetItem *item) {
+            if (item)
+              emit matchActivated(item->data(Qt::UserRole).toInt());
+          });
 }
 
 FindDialog::~FindDialog()
@@ -34,20 +43,111 @@ FindDialog::~FindDialog()
   delete ui;
 }
 
-void FindDialog::findClicked()
+QRegularExpression FindDialog::patternFor(const Options &opts)
+{
+  QString pattern = (opts.isRegexp) ? opts.searchText
+    : QRegularExpression::escape(opts.searchText);
+  if (opts.matchWholeWords)
+    pattern = "\\b(?:" + pattern + ")\\b";
+  return QRegularExpression(pattern, (opts.matchCase)
+                            ? QRegularExpression::NoPatternOption
+                            : QRegularExpression::CaseInsensitiveOption);
+}
+
+bool FindDialog::readOptions()
 {
   if (ui->searchTextComboBox->currentText().length() == 0) {
     ui->searchTextComboBox->setFocus(Qt::OtherFocusReason);
     // TODO: "Flash" the widget background so it is obvious what is going on.
-  } else {
-    options->searchText = ui->searchTextComboBox->currentText();
-    options->fromStart = ui->fromStartCheckBox->isChecked();
-    options->matchCase = ui->caseCheckBox->isChecked();
-    options->matchWholeWords = ui->wholeCheckBox->isChecked();
-    options->isRegexp = ui->regexCheckBox->isChecked();
-    options->searchBackwards = ui->backwardsCheckBox->isChecked();
+    return false;
+  }
+  options->searchText = ui->searchTextComboBox->currentText();
+  options->fromStart = ui->fromStartCheckBox->isChecked();
+  options->matchCase = ui->caseCheckBox->isChecked();
+  options->matchWholeWords = ui->wholeCheckBox->isChecked();
+  options->isRegexp = ui->regexCheckBox->isChecked();
+  options->searchBackwards = ui->backwardsCheckBox->isChecked();
+  return true;
+}
+
+void FindDialog::findClicked()
+{
+  if (readOptions())
     emit findNext(options);
+}
+
+void FindDialog::findAllClicked()
+{
+  if (isFindingAll) {
+    emit stopFindAll();
+    return;
+  }
+  if (!readOptions())
+    return;
+
+  QRegularExpression re = patternFor(*options);
+  if (!re.isValid()) {
+    ui->resultsList->clear();
+    ui->resultsWidget->setVisible(true);
+    ui->resultsLabel->setText(tr("Bad pattern: %1").arg(re.errorString()));
+    return;
   }
+  ui->resultsList->clear();
+  ui->resultsWidget->setVisible(true);
+  isFindingAll = true;
+  searchedCount = totalCount = 0;
+  ui->findAllButton->setText(tr("&Stop"));
+  updateResultsLabel();
+  emit findAll(options);
+}
+
+void FindDialog::addMatches(const QList<OmiSearch::Match> &matches)
+{
+  for (const OmiSearch::Match &match : matches) {
+    QListWidgetItem *item = new QListWidgetItem(
+      tr("%1:%2: %3").arg(match.row + 1).arg(match.position + 1)
+      .arg(match.excerpt));
+    item->setData(Qt::UserRole, match.row);
+    ui->resultsList->addItem(item);
+  }
+  updateResultsLabel();
+}
+
+void FindDialog::showFindAllProgress(int searched, int total)
+{
+  // Workers report out of order, so only ever move forward.
+  searchedCount = qMax(searchedCount, searched);
+  totalCount = total;
+  updateResultsLabel();
+}
+
+void FindDialog::findAllFinished(OmiSearch::Status status)
+{
+  isFindingAll = false;
+  ui->findAllButton->setText(tr("Find &All"));
+  switch (status) {
+  case OmiSearch::Cancelled:
+    updateResultsLabel(tr("stopped"));
+    break;
+  case OmiSearch::TimedOut:
+    updateResultsLabel(tr("out of time"));
+    break;
+  case OmiSearch::TooManyMatches:
+    updateResultsLabel(tr("too many matches"));
+    break;
+  default:
+    updateResultsLabel(tr("done"));
+  }
+}
+
+void FindDialog::updateResultsLabel(const QString &status)
+{
+  QString text = tr("%n match(es) in %1 of %2 entries", nullptr,
+                    ui->resultsList->count())
+    .arg(searchedCount).arg(totalCount);
+  if (!status.isEmpty())
+    text += " (" + status + ")";
+  ui->resultsLabel->setText(text);
 }
 
 void FindDialog::checkBoxStateChanged(int state)
@@ -21,6 +21,8 @@
 
 #include <QDialog>
 #include <QString>
+#include <QRegularExpression>
+#include "omisearch.hh"
 
 namespace Ui {
 class FindDialog;
@@ -42,12 +44,19 @@ public:
   };
   explicit FindDialog(QWidget *parent = nullptr);
   ~FindDialog();
+  static QRegularExpression patternFor(const Options&);
 
 public slots:
   void addSearchTextItem(const QString&);
+  void addMatches(const QList<OmiSearch::Match>&);
+  void showFindAllProgress(int, int);
+  void findAllFinished(OmiSearch::Status);
 
 signals:
   void findNext(FindDialog::Options*);
+  void findAll(FindDialog::Options*);
+  void stopFindAll();
+  void matchActivated(int row);
   void matchCaseCheckBoxStateChanged(int);
   void fromStartCheckBoxStateChanged(int);
   void searchBackwardsCheckBoxStateChanged(int);
@@ -57,12 +66,18 @@ signals:
 
 private slots:
   void findClicked();
+  void findAllClicked();
   void checkBoxStateChanged(int);
   void comboBoxCurrentTextChanged(const QString&);
 
 private:
   Ui::FindDialog *ui;
   FindDialog::Options *options;
+  bool isFindingAll;
+  int searchedCount;
+  int totalCount;
+  bool readOptions();
+  void updateResultsLabel(const QString &status = QString());
 };
 
 #endif // FINDDIALOG_HH
@@ -0,0 +1,123 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "fortunepicker.hh"
+#include <climits>
+
+// Bucket 0 holds the empty entries and bucket b the lengths from
+// 2^(b-1) up to 2^b - 1, so 33 buckets cover every 32-bit length.
+const int bucketCount = 33;
+// Random tries in the buckets at either end of a range before falling
+// back to sorting out which of their entries fit.
+const int maxTries = 32;
+
+FortunePicker::FortunePicker(const OmiDoc::Snapshot &entries)
+  : entries(entries)
+{
+}
+
+int FortunePicker::bucketFor(qint64 length)
+{
+  if (length <= 0)
+    return 0;
+  if (length > UINT_MAX)
+    return bucketCount - 1;
+  return 32 - qCountLeadingZeroBits(static_cast<quint32>(length));
+}
+
+void FortunePicker::buildBuckets()
+{
+  buckets.resize(bucketCount);
+  for (int row = 0; row < entries.count(); row++)
+    buckets[bucketFor(entries.sizeAt(row))].append(row);
+}
+
+int FortunePicker::pick(QRandomGenerator &rng) const
+{
+  if (entries.count() <= 0)
+    return -1;
+  return rng.bounded(entries.count());
+}
+
+int FortunePicker::pick(QRandomGenerator &rng, qint64 minLength,
+                        qint64 maxLength)
+{
+  if (maxLength < 0)
+    maxLength = LLONG_MAX;
+  minLength = qMax<qint64>(0, minLength);
+  if (minLength > maxLength || entries.count() <= 0)
+    return -1;
+  if (buckets.isEmpty())
+    buildBuckets();
+
+  int first = bucketFor(minLength);
+  int last = bucketFor(maxLength);
+  qint64 total = 0;
+  for (int b = first; b <= last; b++)
+    total += buckets.at(b).count();
+  if (!total)
+    return -1;
+
+  // Only the buckets at either end can hold entries that do not fit,
+  // so a try usually lands on one that does.
+  for (int tries = 0; tries < maxTries; tries++) {
+    int row = rowAt(rng.bounded(total), first, last, nullptr, nullptr);
+    qint64 length = entries.sizeAt(row);
+    if (length >= minLength && length <= maxLength)
+      return row;
+  }
+
+  // The range is narrow within its end buckets, so pick from just the
+  // entries there that fit, along with everything in between.
+  QList<int> firstFits, lastFits;
+  for (int row : buckets.at(first)) {
+    qint64 length = entries.sizeAt(row);
+    if (length >= minLength && length <= maxLength)
+      firstFits.append(row);
+  }
+  if (last != first) {
+    for (int row : buckets.at(last))
+      if (entries.sizeAt(row) <= maxLength)
+        lastFits.append(row);
+  }
+  total = firstFits.count() + lastFits.count();
+  for (int b = first + 1; b < last; b++)
+    total += buckets.at(b).count();
+  if (!total)
+    return -1;
+  return rowAt(rng.bounded(total), first, last, &firstFits, &lastFits);
+}
+
+// Finds the nth row from the buckets first to last.  When they are
+// given, firstRows and lastRows stand in for the end buckets.
+int FortunePicker::rowAt(qint64 n, int first, int last,
+                         const QList<int> *firstRows,
+                         const QList<int> *lastRows) const
+{
+  for (int b = first; b <= last; b++) {
+    const QList<int> *rows = &buckets.at(b);
+    if (b == first && firstRows)
+      rows = firstRows;
+    else if (b == last && lastRows)
+      rows = lastRows;
+    if (n < rows->count())
+      return rows->at(n);
+    n -= rows->count();
+  }
+  return -1;
+}
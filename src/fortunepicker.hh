@@ -0,0 +1,53 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FORTUNEPICKER_HH
+#define FORTUNEPICKER_HH
+
+#include <QList>
+#include <QRandomGenerator>
+#include "omidoc.hh"
+
+// Picks entries at random from one section, the way fortune(6) does.
+// For a mapped .omi file a pick reads one table entry and decodes one
+// payload, however big the file is.  Picks limited to a range of
+// lengths go through an index of the entries by the power of two
+// their UTF-8 length falls under, which is built on the first such
+// pick from the table alone.
+class FortunePicker
+{
+public:
+  explicit FortunePicker(const OmiDoc::Snapshot &entries);
+
+  int count() const { return entries.count(); }
+  QString entryAt(int row) const { return entries.at(row); }
+  // These return the row picked, or -1 if there is nothing to pick.
+  // A maxLength below 0 means no limit; lengths are in bytes, as with
+  // fortune -n.
+  int pick(QRandomGenerator &rng) const;
+  int pick(QRandomGenerator &rng, qint64 minLength, qint64 maxLength);
+
+private:
+  OmiDoc::Snapshot entries;
+  QList<QList<int>> buckets;
+  void buildBuckets();
+  int rowAt(qint64, int, int, const QList<int>*, const QList<int>*) const;
+  static int bucketFor(qint64);
+};
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FORTUNEPROTOCOL_HH
+#define FORTUNEPROTOCOL_HH
+
+#include <QtEndian>
+#include "omiformat.hh"
+
+// What a fortune server and its clients say to each other over a
+// local socket.  Requests and replies are both an offset and a length,
+// laid out as a table entry of an .omi file with 32-bit offsets, and a
+// reply is followed by its payload.
+//
+// A request's offset holds the command in its top byte and the number
+// of the corpus, in the order the server was given them, below that.
+// Its length holds the entry number for CommandFortune.
+//
+// A reply's offset holds the entry number picked or asked for, or the
+// count, or replyError.  Its length is the number of UTF-8 bytes that
+// follow it, copied straight from the .omi file.
+
+enum FortuneCommand : quint8 {
+  CommandRandom = 'R',
+  CommandFortune = 'F',
+  CommandCount = 'C'
+};
+
+const quint32 replyError = 0xffffffff;
+const int fortuneMessageSize = 2 * sizeof(quint32);
+
+inline void storeFortuneMessage(char *message, quint32 offset, quint32 length)
+{
+  qToBigEndian<quint32>(offset, message);
+  qToBigEndian<quint32>(length, message + sizeof(quint32));
+}
+
+inline void readFortuneMessage(const char *message, quint32 *offset,
+                               quint32 *length)
+{
+  *offset = qFromBigEndian<quint32>(message);
+  *length = qFromBigEndian<quint32>(message + sizeof(quint32));
+}
+
+inline void storeFortuneRequest(char *request, FortuneCommand command,
+                                quint32 corpus, quint32 index = 0)
+{
+  storeFortuneMessage(request, (static_cast<quint32>(command) << 24)
+                      | (corpus & 0xffffff), index);
+}
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "fortuneserver.hh"
+
+FortuneWorker::FortuneWorker(const QList<OmiDoc::Snapshot> &corpora)
+  : corpora(corpora), rng(QRandomGenerator::global()->generate())
+{
+}
+
+void FortuneWorker::addConnection(quintptr descriptor)
+{
+  QLocalSocket *socket = new QLocalSocket(this);
+  if (!socket->setSocketDescriptor(descriptor)) {
+    delete socket;
+    return;
+  }
+  connect(socket, &QLocalSocket::readyRead, this, &FortuneWorker::readRequests);
+  connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+}
+
+void FortuneWorker::readRequests()
+{
+  QLocalSocket *socket = qobject_cast<QLocalSocket *>(sender());
+  if (!socket)
+    return;
+
+  // Clients may send any number of requests before reading a reply.
+  char request[fortuneMessageSize];
+  while (socket->bytesAvailable() >= static_cast<qint64>(sizeof(request))) {
+    socket->read(request, sizeof(request));
+    answer(socket, request);
+  }
+}
+
+void FortuneWorker::answer(QLocalSocket *socket, const char *request)
+{
+  quint32 offset, index;
+  readFortuneMessage(request, &offset, &index);
+  quint8 command = offset >> 24;
+  quint32 corpus = offset & 0xffffff;
+  quint32 value = replyError;
+  quint32 length = 0;
+  const char *payload = nullptr;
+  QByteArray uncompressed;
+
+  if (corpus < static_cast<quint32>(corpora.count())) {
+    const OmiDoc::Snapshot &entries = corpora.at(corpus);
+    quint32 count = entries.count();
+    switch (command) {
+    case CommandCount:
+      value = count;
+      break;
+    case CommandRandom:
+      if (count)
+        value = rng.bounded(count);
+      break;
+    case CommandFortune:
+      if (index < count)
+        value = index;
+      break;
+    }
+    if (command != CommandCount && value != replyError) {
+      // Entries of a compressed file have to be uncompressed first.
+      if (entries.isCompressed()) {
+        uncompressed = entries.bytesAt(value);
+        payload = uncompressed.constData();
+        length = uncompressed.size();
+      } else {
+        payload = entries.payloadAt(value, &length);
+      }
+      if (!payload) {
+        value = replyError;
+        length = 0;
+      }
+    }
+  }
+
+  char reply[fortuneMessageSize];
+  storeFortuneMessage(reply, value, length);
+  socket->write(reply, sizeof(reply));
+  if (length)
+    socket->write(payload, length);
+}
+
+FortuneServer::FortuneServer(QObject *parent)
+  : QLocalServer(parent), nextWorker(0)
+{
+}
+
+FortuneServer::~FortuneServer()
+{
+  close();
+  for (QThread *thread : threads) {
+    thread->quit();
+    thread->wait();
+  }
+  qDeleteAll(docs);
+}
+
+bool FortuneServer::addCorpus(const QString &filename)
+{
+  // Only mapped files can be served without copying.
+  OmiDoc *doc = new OmiDoc();
+  if (doc->mapFromFile(filename) < 0) {
+    delete doc;
+    return false;
+  }
+  docs.append(doc);
+  corpora.append(doc->snapshot(OmiDoc::Fortunes));
+  return true;
+}
+
+bool FortuneServer::start(const QString &name, int threadCount)
+{
+  if (threadCount <= 0)
+    threadCount = qMax(1, QThread::idealThreadCount());
+  for (int i = 0; i < threadCount; i++) {
+    QThread *thread = new QThread(this);
+    FortuneWorker *worker = new FortuneWorker(corpora);
+    worker->moveToThread(thread);
+    connect(thread, &QThread::finished, worker, &QObject::deleteLater);
+    thread->start();
+    threads.append(thread);
+    workers.append(worker);
+  }
+
+  if (listen(name))
+    return true;
+  if (serverError() != QAbstractSocket::AddressInUseError)
+    return false;
+
+  // A server that went away without cleaning up leaves its socket
+  // behind.  It is only cleared away if nothing answers on it, so as
+  // not to take the name from a server that is still running.
+  QLocalSocket probe;
+  probe.connectToServer(name);
+  if (probe.waitForConnected(1000)) {
+    probe.disconnectFromServer();
+    return false;
+  }
+  QLocalServer::removeServer(name);
+  return listen(name);
+}
+
+void FortuneServer::incomingConnection(quintptr descriptor)
+{
+  // The socket is made in the worker's thread, so that it belongs
+  // there from the start.
+  FortuneWorker *worker = workers.at(nextWorker);
+  nextWorker = (nextWorker + 1) % workers.count();
+  QMetaObject::invokeMethod(worker, [=]() { worker->addConnection(descriptor); });
+}
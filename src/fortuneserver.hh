@@ -0,0 +1,78 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FORTUNESERVER_HH
+#define FORTUNESERVER_HH
+
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QThread>
+#include <QRandomGenerator>
+#include <QList>
+#include "omidoc.hh"
+#include "fortuneprotocol.hh"
+
+// Answers requests on the connections it is handed, from its own
+// thread.  Replies are written from the mapped files, so answering a
+// request makes nothing on the heap, unless the file is compressed.
+class FortuneWorker : public QObject
+{
+  Q_OBJECT
+
+public:
+  explicit FortuneWorker(const QList<OmiDoc::Snapshot> &corpora);
+
+public slots:
+  void addConnection(quintptr descriptor);
+
+private slots:
+  void readRequests();
+
+private:
+  QList<OmiDoc::Snapshot> corpora;
+  QRandomGenerator rng;
+  void answer(QLocalSocket*, const char*);
+};
+
+// Keeps a set of .omi files mapped and serves fortunes from them over
+// a local socket; see fortuneprotocol.hh.  Connections are dealt out
+// in turn to a worker thread per core.
+class FortuneServer : public QLocalServer
+{
+  Q_OBJECT
+
+public:
+  explicit FortuneServer(QObject *parent = nullptr);
+  ~FortuneServer();
+  bool addCorpus(const QString &filename);
+  int corpusCount() const { return corpora.count(); }
+  // A threads of 0 means one per core.
+  bool start(const QString &name, int threads = 0);
+
+protected:
+  void incomingConnection(quintptr descriptor) override;
+
+private:
+  QList<OmiDoc*> docs;
+  QList<OmiDoc::Snapshot> corpora;
+  QList<QThread*> threads;
+  QList<FortuneWorker*> workers;
+  int nextWorker;
+};
+
+#endif
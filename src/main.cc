@@ -18,14 +18,27 @@
  */
 #include <QApplication>
 #include "mainwindow.hh"
+#include "cli.hh"
 
-int main(int argc, char **argv)
+static void setApplicationInfo()
 {
-  QApplication app(argc, argv);
   QCoreApplication::setOrganizationName("Sigio.com");
   QCoreApplication::setOrganizationDomain("sigio.com");
   QCoreApplication::setApplicationName("omiquji");
   QCoreApplication::setApplicationVersion("0.3.1");
+}
+
+int main(int argc, char **argv)
+{
+  // Batch jobs get by without the GUI, and so without a display.
+  if (isCommandLine(argc, argv)) {
+    QCoreApplication app(argc, argv);
+    setApplicationInfo();
+    return runCommandLine(app);
+  }
+
+  QApplication app(argc, argv);
+  setApplicationInfo();
   MainWindow *window = new MainWindow(true);
   window->show();
   return app.exec();
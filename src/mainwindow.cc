@@ -21,9 +21,15 @@
 #include "aboutdialog.hh"
 
 int MainWindow::maxRecentFiles = 0;
+bool MainWindow::useSearchIndex = true;
+int MainWindow::findAllTimeLimit = 0;
 QSettings *MainWindow::settings = 0;
 QStringList MainWindow::recentFiles;
 
+// How long the current file has to be left alone after a change before
+// it is reloaded, as writers seldom finish in one go.
+const int reloadDelay = 500;
+
 MainWindow::MainWindow(bool shouldUpdateActions, QWidget *parent) : QMainWindow(parent)
 {
   ui.setupUi(this);
@@ -39,11 +45,25 @@ MainWindow::MainWindow(bool shouldUpdateActions, QWidget *parent) : QMainWindow(
   clearRecentFilesAction = new QAction(tr("Clear Recent Files"), this);
   connect(clearRecentFilesAction, SIGNAL(triggered()), this, SLOT(clearRecentFiles()));
 
+  watcher = new QFileSystemWatcher(this);
+  reloadTimer = new QTimer(this);
+  reloadTimer->setSingleShot(true);
+  reloadTimer->setInterval(reloadDelay);
+  connect(watcher, &QFileSystemWatcher::fileChanged, reloadTimer,
+          qOverload<>(&QTimer::start));
+  connect(reloadTimer, &QTimer::timeout, this, &MainWindow::reloadChangedFile);
+
   setCurrentFile("");
 
   doc = 0;
+  commentModel = nullptr;
+  fortuneModel = nullptr;
+  loader = nullptr;
+  commentIndex = nullptr;
+  fortuneIndex = nullptr;
 
   findDialog = nullptr;
+  search = nullptr;
   isNewSearch = true;
   searchIndex = 0;
 
@@ -57,6 +77,7 @@ MainWindow::MainWindow(bool shouldUpdateActions, QWidget *parent) : QMainWindow(
   connect(ui.action_Open, SIGNAL(triggered()), this, SLOT(open()));
   connect(ui.action_Save, SIGNAL(triggered()), this, SLOT(save()));
   connect(ui.actionSave_As, SIGNAL(triggered()), this, SLOT(saveAs()));
+  connect(ui.actionCompact, SIGNAL(triggered()), this, SLOT(compact()));
   connect(ui.action_Close, SIGNAL(triggered()), this, SLOT(close()));
   connect(ui.action_Quit, SIGNAL(triggered()), qApp, SLOT(closeAllWindows()));
   connect(ui.action_About, SIGNAL(triggered()), this, SLOT(about()));
@@ -74,79 +95,50 @@ MainWindow::MainWindow(bool shouldUpdateActions, QWidget *parent) : QMainWindow(
   connect(ui.searchCommentButton, SIGNAL(clicked()), this, SLOT(searchComments()));
   connect(ui.searchFortuneButton, SIGNAL(clicked()), this, SLOT(searchFortunes()));
 
-  // Wire QListWidgets up for double click to edit.
-  connect(ui.commentList, SIGNAL(itemDoubleClicked(QListWidgetItem*)), this, SLOT(editComment()));
-  connect(ui.fortuneList, SIGNAL(itemDoubleClicked(QListWidgetItem*)), this, SLOT(editFortune()));
+  // Wire the list views up for double click to edit.
+  connect(ui.commentList, SIGNAL(doubleClicked(QModelIndex)), this, SLOT(editComment()));
+  connect(ui.fortuneList, SIGNAL(doubleClicked(QModelIndex)), this, SLOT(editFortune()));
 
   createStatusBar();
 }
 
-void MainWindow::addComments(const QStringList &list) {
-  ui.commentList->addItems(list);
-}
-
-void MainWindow::addFortunes(const QStringList &list) {
-  ui.fortuneList->addItems(list);
+void MainWindow::selectRow(QListView *view, int row) {
+  view->selectionModel()->setCurrentIndex(view->model()->index(row, 0),
+                                          QItemSelectionModel::ClearAndSelect);
 }
 
 void MainWindow::addComment(QString& text) {
-  if (ui.commentList->currentItem()) {
-    int index = ui.commentList->currentRow() + 1;
-    ui.commentList->insertItem(index, text);
-    ui.commentList->setCurrentRow(index, QItemSelectionModel::ClearAndSelect);
-    emit commentInserted(index, text);
-  } else {
-    ui.commentList->addItem(text);
-    ui.commentList->setCurrentRow(ui.commentList->count() - 1, QItemSelectionModel::ClearAndSelect);
-    emit commentAdded(text);
-  }
+  QModelIndex current = ui.commentList->currentIndex();
+  int index = (current.isValid()) ? current.row() + 1 : doc->commentCount();
+  doc->insertComment(index, text);
+  selectRow(ui.commentList, index);
 }
 
 void MainWindow::addFortune(QString& text) {
-  if (ui.fortuneList->currentItem()) {
-    int index = ui.fortuneList->currentRow() + 1;
-    ui.fortuneList->insertItem(index, text);
-    ui.fortuneList->setCurrentRow(index, QItemSelectionModel::ClearAndSelect);
-    emit fortuneInserted(index, text);
-  } else {
-    ui.fortuneList->addItem(text);
-    ui.fortuneList->setCurrentRow(ui.fortuneList->count() - 1, QItemSelectionModel::ClearAndSelect);
-    emit fortuneAdded(text);
-  }
+  QModelIndex current = ui.fortuneList->currentIndex();
+  int index = (current.isValid()) ? current.row() + 1 : doc->fortuneCount();
+  doc->insertFortune(index, text);
+  selectRow(ui.fortuneList, index);
 }
 
 void MainWindow::replaceCommentAt(int index, QString& text) {
-  if (index < ui.commentList->count()) {
-    QString current = ui.commentList->item(index)->text();
-    if (text != current) {
-      ui.commentList->item(index)->setText(text);
-      emit commentReplacedAt(index, text);
-    }
-  }
+  if (index < doc->commentCount())
+    doc->replaceCommentAt(index, text);
 }
 
 void MainWindow::replaceFortuneAt(int index, QString& text) {
-  if (index < ui.fortuneList->count()) {
-    QString current = ui.fortuneList->item(index)->text();
-    if (text != current) {
-      ui.fortuneList->item(index)->setText(text);
-      emit fortuneReplacedAt(index, text);
-    }
-  }
+  if (index < doc->fortuneCount())
+    doc->replaceFortuneAt(index, text);
 }
 
 void MainWindow::removeCommentAt(int index) {
-  if (index < ui.commentList->count()) {
-    delete ui.commentList->item(index);
-    emit commentRemovedAt(index);
-  }
+  if (index < doc->commentCount())
+    doc->removeCommentAt(index);
 }
 
 void MainWindow::removeFortuneAt(int index) {
-  if (index < ui.fortuneList->count()) {
-    delete ui.fortuneList->item(index);
-    emit fortuneRemovedAt(index);
-  }
+  if (index < doc->fortuneCount())
+    doc->removeFortuneAt(index);
 }
 
 void MainWindow::addComment() {
@@ -165,8 +157,8 @@ void MainWindow::addComment() {
 }
 
 void MainWindow::deleteComment() {
-  if (ui.commentList->currentItem()) {
-    int index = ui.commentList->currentRow();
+  if (ui.commentList->currentIndex().isValid()) {
+    int index = ui.commentList->currentIndex().row();
     removeCommentAt(index);
     setWindowModified(true);
     updateStatusBar();
@@ -174,10 +166,11 @@ void MainWindow::deleteComment() {
 }
 
 void MainWindow::editComment() {
-  if (!ui.commentList->currentItem())
+  QModelIndex current = ui.commentList->currentIndex();
+  if (!current.isValid())
     return;
 
-  QString entry = ui.commentList->currentItem()->text();
+  QString entry = doc->commentAt(current.row());
   EditDialog dlg(this);
   connectEditMenu(&dlg);
   dlg.setWindowTitle(tr("Edit Comment"));
@@ -185,7 +178,7 @@ void MainWindow::editComment() {
 
   if (dlg.exec() == QDialog::Accepted) {
     entry = dlg.textValue();
-    replaceCommentAt(ui.commentList->currentRow(), entry);
+    replaceCommentAt(current.row(), entry);
     setWindowModified(true);
   }
   disconnectEditMenu(&dlg);
@@ -207,8 +200,8 @@ void MainWindow::addFortune() {
 }
 
 void MainWindow::deleteFortune() {
-  if (ui.fortuneList->currentItem()) {
-    int index = ui.fortuneList->currentRow();
+  if (ui.fortuneList->currentIndex().isValid()) {
+    int index = ui.fortuneList->currentIndex().row();
     removeFortuneAt(index);
     setWindowModified(true);
     updateStatusBar();
@@ -216,10 +209,11 @@ void MainWindow::deleteFortune() {
 }
 
 void MainWindow::editFortune() {
-  if (!ui.fortuneList->currentItem())
+  QModelIndex current = ui.fortuneList->currentIndex();
+  if (!current.isValid())
     return;
 
-  QString entry = ui.fortuneList->currentItem()->text();
+  QString entry = doc->fortuneAt(current.row());
   EditDialog dlg(this);
   connectEditMenu(&dlg);
   dlg.setWindowTitle(tr("Edit Fortune"));
@@ -227,15 +221,18 @@ void MainWindow::editFortune() {
 
   if (dlg.exec() == QDialog::Accepted) {
     entry = dlg.textValue();
-    replaceFortuneAt(ui.fortuneList->currentRow(), entry);
+    replaceFortuneAt(current.row(), entry);
     setWindowModified(true);
   }
   disconnectEditMenu(&dlg);
 }
 
 void MainWindow::searchComments() {
-  if (setupSearch(ui.commentList)) {
+  if (setupSearch(OmiDoc::Comments)) {
     connect(findDialog, &FindDialog::findNext, this, &MainWindow::findNextInComments);
+    connect(findDialog, &FindDialog::findAll, this, &MainWindow::findAllInComments);
+    connect(findDialog, &FindDialog::matchActivated, this,
+            [=](int row){this->selectRow(ui.commentList, row);});
   } else {
     QMessageBox::warning(this, "omiquji", tr("There are no comments to search."),
                          QMessageBox::Cancel);
@@ -243,8 +240,11 @@ void MainWindow::searchComments() {
 }
 
 void MainWindow::searchFortunes() {
-  if (setupSearch(ui.fortuneList)) {
+  if (setupSearch(OmiDoc::Fortunes)) {
     connect(findDialog, &FindDialog::findNext, this, &MainWindow::findNextInFortunes);
+    connect(findDialog, &FindDialog::findAll, this, &MainWindow::findAllInFortunes);
+    connect(findDialog, &FindDialog::matchActivated, this,
+            [=](int row){this->selectRow(ui.fortuneList, row);});
   } else {
     QMessageBox::warning(this, "omiquji", tr("There are no fortunes to search."),
                          QMessageBox::Cancel);
@@ -252,23 +252,40 @@ void MainWindow::searchFortunes() {
 }
 
 void MainWindow::findNextInComments(FindDialog::Options *findOpts) {
-  findNext(ui.commentList, findOpts);
+  findNext(ui.commentList, OmiDoc::Comments, commentIndex, findOpts);
 }
 
 void MainWindow::findNextInFortunes(FindDialog::Options *findOpts) {
-  findNext(ui.fortuneList, findOpts);
+  findNext(ui.fortuneList, OmiDoc::Fortunes, fortuneIndex, findOpts);
+}
+
+void MainWindow::findAllInComments(FindDialog::Options *findOpts) {
+  findAll(OmiDoc::Comments, findOpts);
+}
+
+void MainWindow::findAllInFortunes(FindDialog::Options *findOpts) {
+  findAll(OmiDoc::Fortunes, findOpts);
 }
 
-bool MainWindow::setupSearch(QListWidget* target) {
-  if (target->count() > 0) {
+void MainWindow::stopFindAll() {
+  if (search)
+    search->cancel();
+}
+
+bool MainWindow::setupSearch(OmiDoc::Section section) {
+  if (doc && doc->entryCount(section) > 0) {
     if (!findDialog) {
       findDialog = new FindDialog(this);
       connect(findDialog, &FindDialog::fromStartCheckBoxStateChanged, this,
               [=](int state){if (state == Qt::Checked) this->isNewSearch = true;});
       connect(findDialog, &FindDialog::searchTextComboBoxTextChanged, this, [=](){this->isNewSearch = true;});
       connect(this, &MainWindow::searchTextFound, findDialog, &FindDialog::addSearchTextItem);
+      connect(findDialog, &FindDialog::stopFindAll, this, &MainWindow::stopFindAll);
     } else {
       disconnect(findDialog, &FindDialog::findNext, this, nullptr);
+      disconnect(findDialog, &FindDialog::findAll, this, nullptr);
+      disconnect(findDialog, &FindDialog::matchActivated, this, nullptr);
+      stopFindAll();
     }
     findDialog->show();
     findDialog->raise();
@@ -279,47 +296,53 @@ bool MainWindow::setupSearch(QListWidget* target) {
   return false;
 }
 
-void MainWindow::findNext(QListWidget* target, FindDialog::Options *findOpts) {
+void MainWindow::findNext(QListView* target, OmiDoc::Section section,
+                          TrigramIndex *index, FindDialog::Options *findOpts) {
+  int count = doc->entryCount(section);
   int step = (findOpts->searchBackwards) ? -1 : 1;
-  int bound = (findOpts->searchBackwards) ? -1 : target->count();
+  int bound = (findOpts->searchBackwards) ? -1 : count;
   bool found = false;
-  QRegularExpression re; // In case we need it.
 
   if (isNewSearch) {
     isNewSearch = false;
     if (findOpts->fromStart)
-      searchIndex = (findOpts->searchBackwards) ? target->count() - 1 : 0;
+      searchIndex = (findOpts->searchBackwards) ? count - 1 : 0;
     else
-      searchIndex = (target->currentItem()) ? target->currentRow() : 0;
+      searchIndex = (target->currentIndex().isValid()) ? target->currentIndex().row() : 0;
   } else {
     searchIndex += step;
-    if (searchIndex < 0 || searchIndex >= target->count()) {
+    if (searchIndex < 0 || searchIndex >= count) {
       // Start over
       if (findOpts->searchBackwards)
-        searchIndex = target->count() - 1;
+        searchIndex = count - 1;
       else
         searchIndex = 0;
     }
   }
 
-  if (findOpts->matchWholeWords)
-    re.setPattern("\\W" + findOpts->searchText + "\\W");
-  else if (findOpts->isRegexp)
-    re.setPattern(findOpts->searchText);
-
-  if (findOpts->matchWholeWords || findOpts->isRegexp) {
-    if (!findOpts->matchCase)
-      re.setPatternOptions(QRegularExpression::CaseInsensitiveOption);
+  // Only compile the pattern again when it has changed.
+  QRegularExpression re = FindDialog::patternFor(*findOpts);
+  if (re != searchPattern) {
+    searchPattern = re;
+    searchPattern.optimize();
   }
 
+  // Plain searches can skip straight past entries the index rules out.
+  bool useIndex = index && !findOpts->matchWholeWords && !findOpts->isRegexp
+    && index->lookup(findOpts->searchText);
+
   while (searchIndex != bound && !found) {
-    QString entry = target->item(searchIndex)->text();
+    if (useIndex && !index->mayContain(searchIndex)) {
+      searchIndex += step;
+      continue;
+    }
+    QString entry = doc->entryAt(section, searchIndex);
     if (findOpts->matchWholeWords || findOpts->isRegexp)
-      found = entry.contains(re);
+      found = entry.contains(searchPattern);
     else
       found = entry.contains(findOpts->searchText, (findOpts->matchCase) ? Qt::CaseSensitive : Qt::CaseInsensitive);
     if (found) {
-      target->setCurrentRow(searchIndex, QItemSelectionModel::ClearAndSelect);
+      selectRow(target, searchIndex);
       emit searchTextFound(findOpts->searchText);
     }
     else
@@ -329,6 +352,31 @@ void MainWindow::findNext(QListWidget* target, FindDialog::Options *findOpts) {
     QMessageBox::information(this, tr("Not Found"), tr("Search key not found."));
 }
 
+void MainWindow::findAll(OmiDoc::Section section, FindDialog::Options *findOpts) {
+  // A search still running is left to wind down and delete itself;
+  // its results are no longer wanted.
+  if (search) {
+    search->disconnect(findDialog);
+    search->cancel();
+  }
+  // The search works from a snapshot, so the document can still be
+  // edited while it runs.  It has no parent, so that closing the
+  // window never deletes it under its workers.
+  search = new OmiSearch(doc->snapshot(section), FindDialog::patternFor(*findOpts),
+                         MainWindow::findAllTimeLimit * 1000);
+  connect(search, &OmiSearch::matchesFound, findDialog, &FindDialog::addMatches);
+  connect(search, &OmiSearch::progress, findDialog, &FindDialog::showFindAllProgress);
+  connect(search, &OmiSearch::finished, findDialog, &FindDialog::findAllFinished);
+  connect(search, &OmiSearch::finished, search, &QObject::deleteLater);
+  OmiSearch *started = search;
+  connect(search, &OmiSearch::finished, this, [this, started]() {
+    if (search == started)
+      search = nullptr;
+  });
+  search->start();
+  emit searchTextFound(findOpts->searchText);
+}
+
 void MainWindow::setCurrentFile(const QString& filename)
 {
   currentFilename = filename;
@@ -339,6 +387,59 @@ void MainWindow::setCurrentFile(const QString& filename)
     MainWindow::addRecentFile(filename);
   }
   setWindowTitle(tr("%1[*] - omiquji").arg(shownName));
+  watchFile(currentFilename);
+}
+
+void MainWindow::watchFile(const QString& filename)
+{
+  if (!watcher->files().isEmpty())
+    watcher->removePaths(watcher->files());
+  QFileInfo info(filename);
+  watchedModified = info.lastModified();
+  watchedSize = info.size();
+  if (!filename.isEmpty())
+    watcher->addPath(filename);
+}
+
+void MainWindow::reloadChangedFile()
+{
+  if (currentFilename.isEmpty() || !doc || loader)
+    return;
+  QFileInfo info(currentFilename);
+  if (!info.exists())
+    return;
+  // A file replaced by renaming another over it, as careful writers
+  // do, drops out of the watcher.
+  if (!watcher->files().contains(currentFilename))
+    watcher->addPath(currentFilename);
+  if (info.lastModified() == watchedModified && info.size() == watchedSize)
+    return;
+
+  if (isWindowModified()) {
+    int r = QMessageBox::warning(this, "omiquji",
+      tr("%1 has been changed by another program.\n"
+         "Do you want to reload it and lose your changes?").arg(info.fileName()),
+      QMessageBox::Yes | QMessageBox::No);
+    if (r != QMessageBox::Yes) {
+      // Only ask once for each change.
+      watchedModified = info.lastModified();
+      watchedSize = info.size();
+      return;
+    }
+  }
+
+  // Only the entries that differ are touched, so the lists keep their
+  // place and selection.
+  stopFindAll();
+  if (doc->reloadFromFile(currentFilename) < 0) {
+    QMessageBox::warning(this, "omiquji",
+      tr("Cannot reload %1.").arg(info.fileName()), QMessageBox::Ok);
+    watchedModified = info.lastModified();
+    watchedSize = info.size();
+    return;
+  }
+  setCurrentFile(currentFilename);
+  updateStatusBar();
 }
 
 bool MainWindow::okToContinue()
@@ -370,35 +471,78 @@ bool MainWindow::checkDocForSave()
 
 bool MainWindow::saveFile(const QString& filename)
 {
+  // Let OmiDoc open the file, so that it can write a file it has
+  // mapped beside itself and swap it in, rather than truncate it under
+  // a Find All that is still reading it.
   QFile file(filename);
-  bool success = file.open(QIODevice::WriteOnly | QIODevice::Truncate);
-  if (success) {
-    success = (doc->writeToFile(file) > 0) ? true : false;
-    if (success)
-      setCurrentFile(filename);
-    file.close();
-  }
+  // A delta save of an unchanged document writes nothing at all.
+  bool success = (doc->writeToFile(file) >= 0) ? true : false;
+  if (success)
+    setCurrentFile(filename);
   return success;
 }
 
 bool MainWindow::loadFile(const QString& filename)
 {
-  QFile file(filename);
-  bool success = file.open(QIODevice::ReadOnly);
-  if (success) {
+  // .omi files are mapped, and entries decoded as the lists show them.
+  if (filename.endsWith(".omi")) {
     setupOmiDoc();
-    if (doc) {
-      success = (doc->readFromFile(file) > 0) ? true: false;
-      if (success) {
-        setCurrentFile(filename);
-        this->updateStatusBar();
-      }
-    } else {
-      success = false;
+    bool success = (doc->mapFromFile(filename) > 0) ? true : false;
+    if (success) {
+      setCurrentFile(filename);
+      this->updateStatusBar();
     }
-    file.close();
+    return success;
   }
-  return success;
+
+  // Strfiles have to be parsed, so that happens on a worker thread and
+  // the fortunes turn up in the list as they are read.
+  if (loader)
+    return false;
+  setupOmiDoc();
+  loader = new OmiLoader(filename, this);
+  connect(loader, &OmiLoader::entriesRead, this, [=](const QByteArrayList &entries) {
+    doc->insertUtf8Entries(OmiDoc::Fortunes, doc->fortuneCount(), entries);
+    updateStatusBar();
+  });
+  connect(loader, &OmiLoader::progress, this, [=](qint64 bytesRead, qint64 bytesTotal) {
+    if (bytesTotal > 0)
+      loadProgress->setValue(static_cast<int>(bytesRead * 1000 / bytesTotal));
+  });
+  connect(loader, &OmiLoader::finished, this, [=](bool success) {
+    finishLoad(filename, success);
+  });
+  connect(cancelLoadButton, &QPushButton::clicked, loader, &OmiLoader::cancel);
+
+  loadProgress->setValue(0);
+  loadProgress->show();
+  cancelLoadButton->show();
+  ui.action_Save->setEnabled(false);
+  ui.actionSave_As->setEnabled(false);
+  ui.actionCompact->setEnabled(false);
+  loader->start();
+  return true;
+}
+
+void MainWindow::finishLoad(const QString& filename, bool success)
+{
+  loader->deleteLater();
+  loader = nullptr;
+  loadProgress->hide();
+  cancelLoadButton->hide();
+  ui.action_Save->setEnabled(true);
+  ui.actionSave_As->setEnabled(true);
+  ui.actionCompact->setEnabled(true);
+
+  if (success) {
+    setCurrentFile(filename);
+  } else if (doc->commentCount() || doc->fortuneCount()) {
+    // Whatever was read before a cancel or an error stays, but it must
+    // not be saved over the file as though it were all of it.
+    setCurrentFile("");
+    setWindowModified(true);
+  }
+  updateStatusBar();
 }
 
 void MainWindow::newFile()
@@ -451,10 +595,18 @@ bool MainWindow::save()
 bool MainWindow::saveAs()
 {
   if (checkDocForSave()) {
+    QString omifileFilter = tr("Omifile (*.omi)");
+    QString compressedFilter = tr("Compressed Omifile (*.omi)");
+    QString selectedFilter = (doc->isCompressed()) ? compressedFilter : omifileFilter;
     QString filename =
       QFileDialog::getSaveFileName(this, tr("Save Omifile"), ".",
-        tr("Omifile (*.omi);;Strfile (*)"));
+        omifileFilter + ";;" + compressedFilter + ";;" + tr("Strfile (*)"),
+        &selectedFilter);
     if (!filename.isEmpty()) {
+      if (selectedFilter == compressedFilter)
+        doc->setCompressed(true);
+      else if (selectedFilter == omifileFilter)
+        doc->setCompressed(false);
       bool result = saveFile(filename);
       if (result)
         MainWindow::addRecentFile(filename);
@@ -464,6 +616,19 @@ bool MainWindow::saveAs()
   return false;
 }
 
+void MainWindow::compact()
+{
+  if (checkDocForSave()) {
+    // Compacting writes out the whole document, edits and all.
+    if (doc->compact() >= 0)
+      setCurrentFile(currentFilename);
+    else
+      QMessageBox::warning(this, "omiquji",
+        tr("Only an .omi file that has been opened or saved can be compacted."),
+        QMessageBox::Ok);
+  }
+}
+
 void MainWindow::about()
 {
   AboutDialog *dlg = new AboutDialog(this);
@@ -507,6 +672,8 @@ void MainWindow::readSettings()
   if (!MainWindow::settings) {
     MainWindow::settings = new QSettings();
     MainWindow::maxRecentFiles = MainWindow::settings->value("maxRecentFiles", QVariant(10)).toInt();
+    MainWindow::useSearchIndex = MainWindow::settings->value("useSearchIndex", QVariant(true)).toBool();
+    MainWindow::findAllTimeLimit = MainWindow::settings->value("findAllTimeLimit", QVariant(30)).toInt();
     MainWindow::recentFiles = MainWindow::settings->value("recentFiles").toStringList();
     MainWindow::cleanupRecentFiles();
   }
@@ -518,6 +685,8 @@ void MainWindow::writeSettings()
   if (MainWindow::settings) {
     MainWindow::settings->setValue("geometry", this->saveGeometry());
     MainWindow::settings->setValue("maxRecentFiles", MainWindow::maxRecentFiles);
+    MainWindow::settings->setValue("useSearchIndex", MainWindow::useSearchIndex);
+    MainWindow::settings->setValue("findAllTimeLimit", MainWindow::findAllTimeLimit);
     MainWindow::settings->setValue("recentFiles", MainWindow::recentFiles);
   }
 }
@@ -613,28 +782,33 @@ void MainWindow::createStatusBar()
   this->statusBar()->addWidget(commentCounter);
   this->statusBar()->addWidget(fortunesLabel);
   this->statusBar()->addWidget(fortuneCounter);
+  loadProgress = new QProgressBar();
+  loadProgress->setRange(0, 1000);
+  loadProgress->setMaximumWidth(200);
+  loadProgress->hide();
+  cancelLoadButton = new QPushButton(tr("Cancel"));
+  cancelLoadButton->hide();
+  this->statusBar()->addPermanentWidget(loadProgress);
+  this->statusBar()->addPermanentWidget(cancelLoadButton);
 }
 
 void MainWindow::updateStatusBar()
 {
-  commentCounter->setText(QString::number(ui.commentList->count()));
-  fortuneCounter->setText(QString::number(ui.fortuneList->count()));
+  commentCounter->setText(QString::number((doc) ? doc->commentCount() : 0));
+  fortuneCounter->setText(QString::number((doc) ? doc->fortuneCount() : 0));
 }
 
 void MainWindow::setupOmiDoc() {
   if (!doc) {
     doc = new OmiDoc(this);
-    // Connect our signals to OmiDoc's slots:
-    connect(this, SIGNAL(commentAdded(QString&)), doc, SLOT(addComment(QString&)));
-    connect(this, SIGNAL(commentRemovedAt(int)), doc, SLOT(removeCommentAt(int)));
-    connect(this, SIGNAL(commentReplacedAt(int,QString&)), doc, SLOT(replaceCommentAt(int,QString&)));
-    connect(this, SIGNAL(fortuneAdded(QString&)), doc, SLOT(addFortune(QString&)));
-    connect(this, SIGNAL(fortuneRemovedAt(int)), doc, SLOT(removeFortuneAt(int)));
-    connect(this, SIGNAL(fortuneReplacedAt(int,QString&)), doc, SLOT(replaceFortuneAt(int,QString&)));
-    connect(this, SIGNAL(commentInserted(int,QString&)), doc, SLOT(insertComment(int,QString&)));
-    connect(this, SIGNAL(fortuneInserted(int,QString&)), doc, SLOT(insertFortune(int,QString&)));
-    // Connect OmiDoc's signals to our slots
-    connect(doc, SIGNAL(commentsAdded(const QStringList&)), this, SLOT(addComments(const QStringList&)));
-    connect(doc, SIGNAL(fortunesAdded(const QStringList&)), this, SLOT(addFortunes(const QStringList&)));
+    // The lists read straight from the document.
+    commentModel = new OmiListModel(doc, OmiDoc::Comments, this);
+    fortuneModel = new OmiListModel(doc, OmiDoc::Fortunes, this);
+    ui.commentList->setModel(commentModel);
+    ui.fortuneList->setModel(fortuneModel);
+    if (MainWindow::useSearchIndex) {
+      commentIndex = new TrigramIndex(doc, OmiDoc::Comments, this);
+      fortuneIndex = new TrigramIndex(doc, OmiDoc::Fortunes, this);
+    }
   }
 }
@@ -25,6 +25,10 @@
 #include "ui_mainwindow.h"
 #include "omidoc.hh"
 #include "finddialog.hh"
+#include "omilistmodel.hh"
+#include "omiloader.hh"
+#include "trigramindex.hh"
+#include "omisearch.hh"
 class EditDialog;
 
 class MainWindow : public QMainWindow
@@ -35,15 +39,7 @@ public:
   MainWindow(bool shouldUpdateActions = false, QWidget *parent = 0);
 
 signals:
-  void commentAdded(QString&);
-  void commentRemovedAt(int);
-  void commentReplacedAt(int, QString&);
-  void fortuneAdded(QString&);
-  void fortuneRemovedAt(int);
-  void fortuneReplacedAt(int, QString&);
   void searchTextFound(const QString&);
-  void commentInserted(int, QString&);
-  void fortuneInserted(int, QString&);
   
 protected:
   void closeEvent(QCloseEvent*);
@@ -55,13 +51,12 @@ private slots:
   void addFortune();
   void editFortune();
   void deleteFortune();
-  void addComments(const QStringList&);
-  void addFortunes(const QStringList&);
   // Action methods:
   void newFile();
   void open();
   bool save();
   bool saveAs();
+  void compact();
   void about();
   void openRecentFile();
   void clearRecentFiles();
@@ -69,6 +64,10 @@ private slots:
   void searchFortunes();
   void findNextInComments(FindDialog::Options*);
   void findNextInFortunes(FindDialog::Options*);
+  void findAllInComments(FindDialog::Options*);
+  void findAllInFortunes(FindDialog::Options*);
+  void stopFindAll();
+  void reloadChangedFile();
 
 private:
   void addComment(QString&);
@@ -80,8 +79,10 @@ private:
   bool okToContinue();
   bool checkDocForSave();
   bool loadFile(const QString&);
+  void finishLoad(const QString&, bool);
   bool saveFile(const QString&);
   void setCurrentFile(const QString&);
+  void watchFile(const QString&);
   void connectEditMenu(EditDialog*);
   void disconnectEditMenu(EditDialog *dialog=0);
   void readSettings();
@@ -90,13 +91,28 @@ private:
   void updateRecentFileActions();
   void createStatusBar();
   void updateStatusBar();
-  bool setupSearch(QListWidget*);
-  void findNext(QListWidget*, FindDialog::Options*);
+  bool setupSearch(OmiDoc::Section);
+  void findNext(QListView*, OmiDoc::Section, TrigramIndex*, FindDialog::Options*);
+  void findAll(OmiDoc::Section, FindDialog::Options*);
+  void selectRow(QListView*, int);
   void setupOmiDoc();
 
   Ui::MainWindow ui;
   OmiDoc *doc;
+  OmiListModel *commentModel;
+  OmiListModel *fortuneModel;
+  OmiLoader *loader;
+  TrigramIndex *commentIndex;
+  TrigramIndex *fortuneIndex;
+  QProgressBar *loadProgress;
+  QPushButton *cancelLoadButton;
   QString currentFilename;
+  QFileSystemWatcher *watcher;
+  QTimer *reloadTimer;
+  // How the current file looked when it was last read or written, so
+  // that our own saves are not taken for somebody else's.
+  QDateTime watchedModified;
+  qint64 watchedSize;
   QMenu *recentFileMenu;
   QList<QAction *> recentFileActions;
   QAction *separatorAction;
@@ -106,10 +122,14 @@ private:
   QLabel *commentCounter;
   QLabel *fortuneCounter;
   FindDialog *findDialog;
+  OmiSearch *search;
+  QRegularExpression searchPattern;
   bool isNewSearch;
   int searchIndex;
 
   static int maxRecentFiles;
+  static bool useSearchIndex;
+  static int findAllTimeLimit;
   static QSettings *settings;
   static QStringList recentFiles;
   static void addRecentFile(const QString&);
@@ -0,0 +1,96 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "omiblocks.hh"
+#include <QMutexLocker>
+
+// Enough for a screenful of entries from all over a big file.
+const qint64 defaultCacheSize = 8 * 1024 * 1024;
+
+OmiBlocks::OmiBlocks(const char *data, qint64 len, const BlockHeader &header,
+                     bool wide)
+  : data(data), len(len), header(header), wide(wide), cache(defaultCacheSize)
+{
+}
+
+void OmiBlocks::setCacheSize(qint64 bytes)
+{
+  QMutexLocker locker(&mutex);
+  cache.setMaxCost(bytes);
+}
+
+QByteArray OmiBlocks::block(quint32 i) const
+{
+  {
+    QMutexLocker locker(&mutex);
+    if (QByteArray *cached = cache.object(i))
+      return *cached;
+  }
+
+  // Uncompress outside the lock, so that other threads can carry on
+  // with blocks that are already cached.
+  if (i >= header.blocks.length)
+    return QByteArray();
+  TableEntry entry;
+  copyTableEntry(&entry, data, header.blocks.offset + i * tableEntrySize(wide),
+                 wide);
+  if (entry.offset < static_cast<quint64>(omikujiHeaderSize(wide)
+                                          + blockHeaderSize(wide))
+      || entry.offset > static_cast<quint64>(len)
+      || static_cast<qint64>(entry.offset) + entry.length > len)
+    return QByteArray();
+  QByteArray bytes = qUncompress(reinterpret_cast<const uchar*>(data)
+                                 + entry.offset, entry.length);
+  qint64 expected = qMin<qint64>(header.blockSize, static_cast<qint64>(header.payloadSize)
+                                 - static_cast<qint64>(i) * header.blockSize);
+  if (bytes.size() != expected)
+    return QByteArray();
+
+  QMutexLocker locker(&mutex);
+  cache.insert(i, new QByteArray(bytes), bytes.size());
+  return bytes;
+}
+
+QByteArray OmiBlocks::payload(quint64 offset, quint32 length) const
+{
+  if (offset > header.payloadSize || offset + length > header.payloadSize)
+    return QByteArray();
+
+  quint32 first = offset / header.blockSize;
+  quint32 last = (length) ? (offset + length - 1) / header.blockSize : first;
+  quint32 skip = offset % header.blockSize;
+  if (first == last) {
+    QByteArray bytes = block(first);
+    if (length && bytes.size() < static_cast<qint64>(skip) + length)
+      return QByteArray();
+    return bytes.mid(skip, length);
+  }
+
+  // An entry that straddles blocks is pieced together from each.
+  QByteArray result;
+  result.reserve(length);
+  for (quint32 i = first; i <= last; i++) {
+    QByteArray bytes = block(i);
+    if (bytes.isEmpty())
+      return QByteArray();
+    quint32 take = qMin<quint32>(length - result.size(), bytes.size() - skip);
+    result.append(bytes.constData() + skip, take);
+    skip = 0;
+  }
+  return result;
+}
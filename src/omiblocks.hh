@@ -0,0 +1,52 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OMIBLOCKS_HH
+#define OMIBLOCKS_HH
+
+#include <QByteArray>
+#include <QCache>
+#include <QMutex>
+#include "omiformat.hh"
+
+// The payloads of a compressed .omi file, read a block at a time from
+// a mapping or buffer that outlives it.  Blocks that have been
+// uncompressed are kept in a cache of bounded size, so entries near
+// each other cost one qUncompress() between them.  Safe to share
+// between threads.
+class OmiBlocks
+{
+public:
+  OmiBlocks(const char *data, qint64 len, const BlockHeader &header, bool wide);
+  qint64 payloadSize() const { return header.payloadSize; }
+  // The length bytes at offset in the uncompressed payloads, or an
+  // empty array if a block they are in is damaged.
+  QByteArray payload(quint64 offset, quint32 length) const;
+  void setCacheSize(qint64 bytes);
+
+private:
+  const char *data;
+  qint64 len;
+  BlockHeader header;
+  bool wide;
+  mutable QMutex mutex;
+  mutable QCache<quint32, QByteArray> cache;
+  QByteArray block(quint32) const;
+};
+
+#endif
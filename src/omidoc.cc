@@ -17,103 +17,683 @@
  * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "omidoc.hh"
+#include "strfilereader.hh"
+#include "strfileindex.hh"
+#include <QSaveFile>
 #include <QtEndian>
 #include <QList>
 #include <QByteArray>
+#include <QFileInfo>
+#include <QStringEncoder>
+#include <QQueue>
+#include <QSet>
+#include <QThreadPool>
+#include <QtConcurrent>
 #include <cstring>
+#include <climits>
+#include <algorithm>
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
 
-struct TableEntry {
-  quint32 offset;
-  quint32 length;
+template <typename Encoder, typename Writer>
+qint64 pipeBatches(int entries, Encoder encode, Writer write);
+
+// Reads entry i of a mapped table, and checks that its payload is
+// there, in the file or among the compressed blocks.
+static bool mappedEntry(const uchar *data, qint64 size, const OmiBlocks *blocks,
+                        quint64 table, int count, int i, TableEntry *entry,
+                        bool wide);
+static QString mappedString(const uchar *data, const OmiBlocks *blocks,
+                            const TableEntry &entry);
+static QByteArray mappedBytes(const uchar *data, const OmiBlocks *blocks,
+                              const TableEntry &entry);
+static bool mappedEquals(const uchar *data, qint64 size, const OmiBlocks *blocks,
+                         const TableEntry &entry, const QByteArray &bytes,
+                         bool wide);
+static bool sameBytes(QByteArrayView a, QByteArrayView b);
+// Points entries that share a payload in the file at one copy of it,
+// and returns how many bytes of copies that leaves unused.
+static qint64 shareRepeatedEntries(QList<ArenaSpan> *lists[2], int firsts[2],
+                                   const QList<TableEntry> *spans[2],
+                                   int spanFirsts[2]);
+
+// One stretch of a table read on a worker thread, with its payloads
+// copied into an arena of its own.
+struct DecodedRange {
+  Utf8Arena arena;
+  QList<ArenaSpan> entries;
+  QList<TableEntry> spans;
+  qint64 bytesRead = 0;
+  // Whether the range stopped at an entry that points outside the file.
+  bool damaged = false;
+};
+DecodedRange decodeTableRange(const char *data, qint64 len,
+                              const OmiBlocks *blocks, quint64 table,
+                              quint32 first, quint32 last, bool wide);
+static DecodedRange decodeStrfileRange(const char *data,
+                                       const QList<quint64> *offsets,
+                                       int first, int last);
+
+// What an entry is compared by when a file is reloaded.
+struct EntryKey {
+  qint64 length;
+  quint64 digest;
+  bool operator==(const EntryKey &other) const
+    { return length == other.length && digest == other.digest; }
 };
+static QList<EntryKey> entryKeys(const OmiDoc::Snapshot &entries);
 
-struct OmikujiHeader {
-  char signature[7];
-  char version;
-  TableEntry commentHeader;
-  TableEntry fortuneHeader;
+// How a section has to change to match a reloaded file: runs of
+// entries replaced where they are, then one stretch where entries were
+// removed or inserted.  Edits in one place come out exactly; edits in
+// several places where the count also changed come out as replacing
+// everything from the first to the last of them.
+struct ReloadPlan {
+  QList<QPair<int, int>> replaced;
+  int index = 0;
+  int removed = 0;
+  int inserted = 0;
 };
+static ReloadPlan planReload(const QList<EntryKey> &before,
+                             const QList<EntryKey> &after);
+// Which file a path names, as its device and inode, or zeros where
+// there is no telling.  A file rewritten in place keeps both; one
+// renamed over it does not.
+static void fileIdentity(const QString &filename, quint64 *device,
+                         quint64 *inode);
 
-const char omikuji_version = 0;
-const char *omikuji_signature = "omikuji";
+// A batch of entries encoded for an .omi file, along with the digests
+// of those that have a payload of their own when there is an index to
+// write.
+struct OmiDoc::EncodedBatch {
+  int first = 0;
+  int last = 0;
+  QByteArray bytes;
+  QList<quint64> digests;
+};
+
+// A batch of entries encoded for a strfile, with the length of each
+// entry written, for its strfile(8) index.
+struct OmiDoc::StrfileBatch {
+  QByteArray bytes;
+  QList<quint32> lengths;
+};
 
-bool checkOmikujiHeader(const OmikujiHeader header);
-TableEntry *copyTableEntry(TableEntry *entry, char *data, quint32 offset);
-qint64 writeStringListToStrfileStream(QDataStream &stream, QStringList *list,
-                                      const char *separator, bool &wantSeparator);
+// Table entries are written out this many at a time.
+const int tableBlockSize = 512;
+// Entries are encoded for output in batches of this many.
+const int encodeBatchSize = 4096;
+// Tables are decoded in ranges of this many entries.
+const quint32 decodeRangeSize = 16384;
+// Compressed files hold their payloads in blocks of this many bytes.
+const quint32 compressedBlockSize = 64 * 1024;
+// The arena is compacted once at least this much of it is unused, and
+// more of it is unused than not.
+const qint64 compactArenaSize = 4 * 1024 * 1024;
+// Strfiles are read into the document this many entries at a time.
+const int strfileBatchSize = 16384;
 
 OmiDoc::~OmiDoc() {
-  delete commentList;
-  delete fortuneList;
+  unmap();
 }
 
 void OmiDoc::addComment(QString &comment) {
-  commentList->append(comment);
+  insertEntries(Comments, commentCount(), QStringList{ comment });
 }
 
 void OmiDoc::addFortune(QString &fortune) {
-  fortuneList->append(fortune);
+  insertEntries(Fortunes, fortuneCount(), QStringList{ fortune });
 }
 
 void OmiDoc::removeCommentAt(int i) {
-  if (i < commentList->count()) {
-    QString current = commentList->at(i);
-    commentList->removeAt(i);
-  }
+  if (i < commentCount())
+    removeEntries(Comments, i, 1);
 }
 
 void OmiDoc::removeFortuneAt(int i) {
-  if (i < fortuneList->count()) {
-    QString current = fortuneList->at(i);
-    fortuneList->removeAt(i);
-  }
+  if (i < fortuneCount())
+    removeEntries(Fortunes, i, 1);
 }
 
 void OmiDoc::replaceCommentAt(int i, QString& text) {
-  if (i < commentList->count()) {
-    QString current = commentList->at(i);
-    if (current != text) {
-      commentList->replace(i, text);
-    }
-  }
+  if (i < commentCount() && entryAt(Comments, i) != text)
+    replaceEntries(Comments, i, QStringList{ text });
 }
 
 void OmiDoc::replaceFortuneAt(int i, QString& text) {
-  if (i < fortuneList->count()) {
-    QString current = fortuneList->at(i);
-    if (current != text) {
-      fortuneList->replace(i, text);
-    }
-  }
+  if (i < fortuneCount() && entryAt(Fortunes, i) != text)
+    replaceEntries(Fortunes, i, QStringList{ text });
 }
 
 void OmiDoc::insertComment(int i, QString &text) {
-  commentList->insert(i, text);
+  insertEntries(Comments, i, QStringList{ text });
 }
 
 void OmiDoc::insertFortune(int i, QString &text) {
-  fortuneList->insert(i, text);
+  insertEntries(Fortunes, i, QStringList{ text });
+}
+
+void OmiDoc::insertEntries(Section section, int index, QStringList &&entries) {
+  if (mappedFile) materialize();
+  if (entries.isEmpty() || index < 0 || index > entriesFor(section).count())
+    return;
+
+  // Encoded once, straight into the arena; the strings go with the list.
+  QStringEncoder encoder(QStringEncoder::Utf8, QStringEncoder::Flag::Stateless);
+  QList<ArenaSpan> spans;
+  spans.reserve(entries.count());
+  for (const QString &entry : entries)
+    spans.append(arena.add(entry, encoder));
+  entries.clear();
+  insertSpans(section, index, std::move(spans));
+}
+
+void OmiDoc::insertUtf8Entries(Section section, int index,
+                               const QByteArrayList &entries) {
+  if (mappedFile) materialize();
+  if (entries.isEmpty() || index < 0 || index > entriesFor(section).count())
+    return;
+
+  qint64 bytes = 0;
+  for (const QByteArray &entry : entries)
+    bytes += entry.size();
+  arena.reserve(bytes);
+  QList<ArenaSpan> spans;
+  spans.reserve(entries.count());
+  for (const QByteArray &entry : entries)
+    spans.append(arena.add(entry.constData(), entry.size()));
+  insertSpans(section, index, std::move(spans));
+}
+
+void OmiDoc::insertSpans(Section section, int index, QList<ArenaSpan> &&spans) {
+  QList<ArenaSpan> &list = entriesFor(section);
+  int count = spans.count();
+
+  emit entriesAboutToChange(section, index, 0, count);
+  if (index == list.count()) {
+    list.append(std::move(spans));
+  } else {
+    list.insert(index, count, ArenaSpan());
+    std::copy(spans.cbegin(), spans.cend(), list.begin() + index);
+  }
+  trackInsert(section, index, count);
+  emit entriesChanged(section, index, 0, count);
+}
+
+void OmiDoc::removeEntries(Section section, int index, int count) {
+  if (mappedFile) materialize();
+  QList<ArenaSpan> &list = entriesFor(section);
+  if (index < 0 || count <= 0 || index >= list.count())
+    return;
+  count = qMin<int>(count, list.count() - index);
+
+  emit entriesAboutToChange(section, index, count, 0);
+  dropSpans(section, index, count);
+  list.remove(index, count);
+  trackRemove(section, index, count);
+  emit entriesChanged(section, index, count, 0);
+  compactArena();
+}
+
+void OmiDoc::replaceEntries(Section section, int index, QStringList &&entries) {
+  if (mappedFile) materialize();
+  QList<ArenaSpan> &list = entriesFor(section);
+  if (index < 0 || index >= list.count() || entries.isEmpty())
+    return;
+  // Entries that would run off the end are dropped.
+  int count = qMin<int>(entries.count(), list.count() - index);
+
+  emit entriesAboutToChange(section, index, count, count);
+  dropSpans(section, index, count);
+  QStringEncoder encoder(QStringEncoder::Utf8, QStringEncoder::Flag::Stateless);
+  for (int i = 0; i < count; i++)
+    list[index + i] = arena.add(entries.at(i), encoder);
+  entries.clear();
+  trackReplace(section, index, count);
+  emit entriesChanged(section, index, count, count);
+  compactArena();
+}
+
+void OmiDoc::moveEntries(Section section, int index, int count, int destination) {
+  if (mappedFile) materialize();
+  QList<ArenaSpan> &list = entriesFor(section);
+  if (index < 0 || count <= 0 || index + count > list.count()
+      || destination < 0 || destination > list.count()
+      || (destination >= index && destination <= index + count))
+    return;
+
+  emit entriesAboutToMove(section, index, count, destination);
+  if (destination > index)
+    std::rotate(list.begin() + index, list.begin() + index + count,
+                list.begin() + destination);
+  else
+    std::rotate(list.begin() + destination, list.begin() + index,
+                list.begin() + index + count);
+  trackMove(section, index, count, destination);
+  emit entriesMoved(section, index, count, destination);
+}
+
+void OmiDoc::dropSpans(Section section, int index, int count) {
+  // A payload shared with another entry is counted as though it were
+  // not, which only brings compaction on a little early.
+  const QList<ArenaSpan> &list = entriesFor(section);
+  for (int i = index; i < index + count; i++)
+    deadBytes += list.at(i).length;
+}
+
+void OmiDoc::compactArena() {
+  if (deadBytes < compactArenaSize || 2 * deadBytes < arena.size())
+    return;
+
+  // Each payload is copied once, however many entries share it.
+  Utf8Arena fresh;
+  fresh.reserve(arena.size() - deadBytes);
+  QHash<quint64, ArenaSpan> moved;
+  QList<ArenaSpan> *lists[2] = { &commentEntries, &fortuneEntries };
+  for (QList<ArenaSpan> *list : lists) {
+    for (ArenaSpan &span : *list) {
+      if (!span.length)
+        continue;
+      quint64 key = (static_cast<quint64>(span.chunk) << 32) | span.offset;
+      auto it = moved.constFind(key);
+      if (it != moved.constEnd()) {
+        span = *it;
+      } else {
+        QByteArrayView bytes = arena.view(span);
+        span = fresh.add(bytes.data(), bytes.size());
+        moved.insert(key, span);
+      }
+    }
+  }
+  arena = fresh;
+  deadBytes = 0;
+}
+
+void OmiDoc::clearEntries() {
+  commentEntries.clear();
+  fortuneEntries.clear();
+  arena.clear();
+  deadBytes = 0;
 }
 
 int OmiDoc::commentCount() {
-  return commentList->count();
+  if (mappedFile) return commentTableCount;
+  return commentEntries.count();
 }
 
 int OmiDoc::fortuneCount() {
-  return fortuneList->count();
+  if (mappedFile) return fortuneTableCount;
+  return fortuneEntries.count();
+}
+
+QString OmiDoc::commentAt(int i) {
+  if (mappedFile) return mappedEntryAt(commentTable, commentTableCount, i);
+  return arena.string(commentEntries.at(i));
+}
+
+QString OmiDoc::fortuneAt(int i) {
+  if (mappedFile) return mappedEntryAt(fortuneTable, fortuneTableCount, i);
+  return arena.string(fortuneEntries.at(i));
+}
+
+int OmiDoc::entryCount(Section section) const {
+  if (section == Comments)
+    return (mappedFile) ? commentTableCount : commentEntries.count();
+  return (mappedFile) ? fortuneTableCount : fortuneEntries.count();
+}
+
+QString OmiDoc::entryAt(Section section, int i) const {
+  // Bypasses the decoded cache so that a save does not flush it.
+  if (section == Comments) {
+    if (mappedFile) return decodeMappedEntry(commentTable, commentTableCount, i);
+    return arena.string(commentEntries.at(i));
+  }
+  if (mappedFile) return decodeMappedEntry(fortuneTable, fortuneTableCount, i);
+  return arena.string(fortuneEntries.at(i));
+}
+
+QByteArrayView OmiDoc::entryUtf8(Section section, int i,
+                                 QByteArray &buffer) const {
+  // Only an entry of a compressed file has to be copied, into buffer.
+  if (!mappedFile)
+    return arena.view(entriesFor(section).at(i));
+
+  TableEntry entry;
+  quint64 table = (section == Comments) ? commentTable : fortuneTable;
+  int count = (section == Comments) ? commentTableCount : fortuneTableCount;
+  if (!mappedTableEntry(table, count, i, &entry))
+    return QByteArrayView();
+  if (blocks) {
+    buffer = blocks->payload(entry.offset, entry.length);
+    return buffer;
+  }
+  return QByteArrayView(reinterpret_cast<const char*>(mappedData) + entry.offset,
+                        entry.length);
+}
+
+OmiDoc::Snapshot OmiDoc::snapshot(Section section) const {
+  Snapshot snap;
+  if (mappedFile) {
+    snap.file = mappedFile;
+    snap.blocks = blocks;
+    snap.data = mappedData;
+    snap.size = mappedSize;
+    snap.table = (section == Comments) ? commentTable : fortuneTable;
+    snap.tableCount = (section == Comments) ? commentTableCount : fortuneTableCount;
+    snap.wide = mappedWide;
+  } else {
+    // The arena and the list are implicitly shared, so this copy is
+    // cheap until the document is next edited.
+    snap.arena = arena;
+    snap.entries = entriesFor(section);
+  }
+  return snap;
+}
+
+int OmiDoc::Snapshot::count() const {
+  return (file) ? tableCount : entries.count();
+}
+
+QString OmiDoc::Snapshot::at(int i) const {
+  if (!file)
+    return arena.string(entries.at(i));
+
+  TableEntry entry;
+  if (!mappedEntry(data, size, blocks.data(), table, tableCount, i, &entry,
+                   wide))
+    return QString();
+  return mappedString(data, blocks.data(), entry);
+}
+
+qint64 OmiDoc::Snapshot::sizeAt(int i) const {
+  if (!file)
+    return entries.at(i).length;
+
+  TableEntry entry;
+  if (!mappedEntry(data, size, blocks.data(), table, tableCount, i, &entry,
+                   wide))
+    return 0;
+  return entry.length;
+}
+
+const char *OmiDoc::Snapshot::payloadAt(int i, quint32 *length) const {
+  if (!file) {
+    // An empty entry has no bytes to point at, but is still there.
+    const char *payload = arena.view(entries.at(i)).data();
+    *length = entries.at(i).length;
+    return (payload) ? payload : "";
+  }
+
+  TableEntry entry;
+  if (blocks || !mappedEntry(data, size, nullptr, table, tableCount, i, &entry,
+                             wide))
+    return nullptr;
+  *length = entry.length;
+  return reinterpret_cast<const char*>(data) + entry.offset;
+}
+
+QByteArray OmiDoc::Snapshot::bytesAt(int i) const {
+  if (!file)
+    return arena.view(entries.at(i)).toByteArray();
+
+  TableEntry entry;
+  if (!mappedEntry(data, size, blocks.data(), table, tableCount, i, &entry,
+                   wide))
+    return QByteArray();
+  return mappedBytes(data, blocks.data(), entry);
+}
+
+QByteArrayView OmiDoc::Snapshot::utf8At(int i, QByteArray &buffer) const {
+  quint32 length;
+  if (const char *payload = payloadAt(i, &length))
+    return QByteArrayView(payload, length);
+  buffer = bytesAt(i);
+  return buffer;
+}
+
+bool OmiDoc::contains(Section section, const QString &text) const {
+  QByteArray bytes = text.toUtf8();
+  if (!mappedFile) {
+    for (const ArenaSpan &span : entriesFor(section))
+      if (sameBytes(arena.view(span), bytes))
+        return true;
+    return false;
+  }
+
+  if (hashIndex.isValid()) {
+    quint64 digest = payloadDigest(bytes.constData(), bytes.size());
+    for (const TableEntry &entry : hashIndex.find(section, digest))
+      if (mappedEquals(mappedData, mappedSize, blocks.data(), entry, bytes,
+                       mappedWide))
+        return true;
+    return false;
+  }
+
+  // Without an index every entry has to be looked at, though only the
+  // ones of the right length need their payloads read.
+  quint64 table = (section == Comments) ? commentTable : fortuneTable;
+  int count = (section == Comments) ? commentTableCount : fortuneTableCount;
+  TableEntry entry;
+  for (int i = 0; i < count; i++)
+    if (mappedTableEntry(table, count, i, &entry)
+        && entry.length == static_cast<quint32>(bytes.size())
+        && mappedEquals(mappedData, mappedSize, blocks.data(), entry, bytes,
+                        mappedWide))
+      return true;
+  return false;
+}
+
+qint64 OmiDoc::mapFromFile(const QString &filename) {
+  emit aboutToReset();
+  qint64 len = mapFile(filename);
+  emit reset();
+  return len;
+}
+
+qint64 OmiDoc::mapFile(const QString &filename) {
+  unmap();
+  QFile *file = new QFile(filename);
+  if (!file->open(QIODevice::ReadOnly)) {
+    delete file;
+    return -1;
+  }
+
+  qint64 len = file->size();
+  uchar *data = nullptr;
+  if (len >= omikujiHeaderSize(false))
+    data = file->map(0, len);
+  // The mapping outlives the open file descriptor, so close it now.
+  file->close();
+  if (!data) {
+    delete file;
+    return -1;
+  }
+
+  OmikujiHeader header;
+  if (!readOmikujiHeader(&header, reinterpret_cast<const char*>(data), len)) {
+    delete file;
+    return -1;
+  }
+  bool wide = isWideVersion(header.version);
+  QSharedPointer<OmiBlocks> fileBlocks;
+  if (isCompressedVersion(header.version)) {
+    BlockHeader blockHeader;
+    if (!readBlockHeader(&blockHeader, reinterpret_cast<const char*>(data), len,
+                         wide)) {
+      delete file;
+      return -1;
+    }
+    fileBlocks.reset(new OmiBlocks(reinterpret_cast<const char*>(data), len,
+                                   blockHeader, wide));
+  }
+
+  // Work out how many table entries actually fit in the file, and
+  // stop short of the first one whose payload does not, just as when
+  // the file is read.
+  quint64 offsets[2] = { header.commentHeader.offset,
+                         header.fortuneHeader.offset };
+  quint32 lengths[2] = { header.commentHeader.length,
+                         header.fortuneHeader.length };
+  int counts[2] = { 0, 0 };
+  for (int t = 0; t < 2; t++) {
+    if (offsets[t] >= static_cast<quint64>(omikujiHeaderSize(wide))
+        && offsets[t] < static_cast<quint64>(len)) {
+      quint64 fit = (len - offsets[t]) / tableEntrySize(wide);
+      quint64 count = qMin<quint64>(lengths[t], fit);
+      counts[t] = static_cast<int>(qMin<quint64>(count, INT_MAX));
+    }
+    TableEntry entry;
+    for (int i = 0; i < counts[t]; i++) {
+      if (!mappedEntry(data, len, fileBlocks.data(), offsets[t], counts[t], i,
+                       &entry, wide)) {
+        counts[t] = i;
+        break;
+      }
+    }
+  }
+
+  clearEntries();
+  mappedFile.reset(file);
+  blocks = fileBlocks;
+  compressed = !blocks.isNull();
+  mappedData = data;
+  mappedSize = len;
+  indexed = hashIndex.open(data, len);
+  commentTable = offsets[0];
+  commentTableCount = counts[0];
+  fortuneTable = offsets[1];
+  fortuneTableCount = counts[1];
+  mappedWide = wide;
+  fileIdentity(filename, &mappedDevice, &mappedInode);
+
+  // A compressed file is always written out whole, so it needs no
+  // origin for delta saves.
+  clearOrigin();
+  if (!compressed) {
+    setOrigin(filename);
+    originWide = wide;
+    commentOrigin.table = { offsets[0], lengths[0] };
+    fortuneOrigin.table = { offsets[1], lengths[1] };
+  }
+
+  return len;
+}
+
+QString OmiDoc::mappedEntryAt(quint64 table, int count, int i) {
+  // Cached by payload, so that entries sharing one also share the
+  // decoded string.
+  TableEntry entry;
+  if (!mappedTableEntry(table, count, i, &entry))
+    return QString();
+  QString *cached = decodedCache.object(entry);
+  if (cached)
+    return *cached;
+
+  QString str = mappedString(mappedData, blocks.data(), entry);
+  decodedCache.insert(entry, new QString(str), str.size() + 1);
+  return str;
+}
+
+QString OmiDoc::decodeMappedEntry(quint64 table, int count, int i) const {
+  TableEntry entry;
+  if (!mappedTableEntry(table, count, i, &entry))
+    return QString();
+
+  return mappedString(mappedData, blocks.data(), entry);
+}
+
+bool OmiDoc::mappedTableEntry(quint64 table, int count, int i,
+                              TableEntry *entry) const {
+  return mappedEntry(mappedData, mappedSize, blocks.data(), table, count, i,
+                     entry, mappedWide);
 }
 
-const QString& OmiDoc::commentAt(int i) {
-  return commentList->at(i);
+void OmiDoc::materialize() {
+  // Copy every payload into the arena so the document can be edited.
+  // The mapped tables become the spans for the next delta save.
+  Utf8Arena copied;
+  QList<ArenaSpan> comments, fortunes;
+  QList<TableEntry> commentSpans, fortuneSpans;
+  QList<ArenaSpan> *lists[2] = { &comments, &fortunes };
+  QList<TableEntry> *spans[2] = { &commentSpans, &fortuneSpans };
+  Section sections[2] = { Comments, Fortunes };
+  QByteArray buffer;
+  TableEntry entry;
+  for (int t = 0; t < 2; t++) {
+    quint64 table = (t == 0) ? commentTable : fortuneTable;
+    int count = (t == 0) ? commentTableCount : fortuneTableCount;
+    lists[t]->reserve(count);
+    spans[t]->reserve(count);
+    for (int i = 0; i < count; i++) {
+      if (!mappedTableEntry(table, count, i, &entry))
+        entry = { 0, 0 };
+      QByteArrayView bytes = entryUtf8(sections[t], i, buffer);
+      lists[t]->append(copied.add(bytes.data(), bytes.size()));
+      spans[t]->append(entry);
+    }
+  }
+  int firsts[2] = { 0, 0 };
+  const QList<TableEntry> *fileSpans[2] = { &commentSpans, &fortuneSpans };
+  qint64 shared = shareRepeatedEntries(lists, firsts, fileSpans, firsts);
+  unmap();
+  clearEntries();
+  arena = copied;
+  commentEntries = comments;
+  fortuneEntries = fortunes;
+  deadBytes = shared;
+  compactArena();
+  if (!originFile.isEmpty()) {
+    commentOrigin.spans = commentSpans;
+    fortuneOrigin.spans = fortuneSpans;
+  }
 }
 
-const QString& OmiDoc::fortuneAt(int i) {
-  return fortuneList->at(i);
+void OmiDoc::unmap() {
+  if (mappedFile) {
+    // Deleting the QFile drops the mapping with it, once no snapshot
+    // holds on to it either.
+    mappedFile.reset();
+    blocks.reset();
+    mappedData = nullptr;
+    mappedSize = 0;
+    hashIndex = OmiHashIndex();
+    commentTable = fortuneTable = 0;
+    commentTableCount = fortuneTableCount = 0;
+    mappedWide = false;
+    mappedDevice = mappedInode = 0;
+    decodedCache.clear();
+  }
 }
 
 qint64 OmiDoc::writeToFile(QFile &output) {
+  // Saving an .omi file back over itself only needs the edits, as long
+  // as it is to stay laid out as it is: uncompressed, without shared
+  // payloads, and with an index only if it already has one.
+  if (!output.isOpen() && output.fileName().endsWith(".omi")
+      && !compressed && !deduplicate && indexed == (originIndexSize != 0)
+      && isOriginFile(output))
+    return writeDeltaToFile(output);
+
+  return writeWholeFile(output);
+}
+
+qint64 OmiDoc::writeWholeFile(QFile &output) {
   bool wantClose = false;
   qint64 bytesOut = 0;
+  QList<quint64> strfileOffsets;
+
+  // Writing over the file that we have mapped would pull the rug out
+  // from under the mapping, and from under any snapshot of it that a
+  // search or an index build is still reading.  So the new file is
+  // swapped in whole, or, if the file has been opened for us already,
+  // everything is decoded first.
+  if (mappedFile && QFileInfo(output).canonicalFilePath()
+      == QFileInfo(*mappedFile).canonicalFilePath()) {
+    if (!output.isOpen() && output.fileName().endsWith(".omi"))
+      return replaceFile(output.fileName());
+    materialize();
+  }
 
   if (!output.isOpen()) {
     if (output.open(QIODevice::WriteOnly | QIODevice::Truncate))
@@ -122,109 +702,787 @@ qint64 OmiDoc::writeToFile(QFile &output) {
       return -1;
   }
   QDataStream out(&output);
-  if (output.fileName().endsWith(".omi")) {
+  clearOrigin();
+  bool isOmifile = output.fileName().endsWith(".omi");
+  if (isOmifile && compressed) {
+    bytesOut = this->writeCompressedOmifileToStream(out);
+  } else if (isOmifile) {
     bytesOut = this->writeOmifileToStream(out);
   } else {
-    bytesOut = this->writeStrfileToStream(out);
+    bytesOut = this->writeStrfileToStream(out, &strfileOffsets);
   }
 
   if (wantClose) output.close();
+
+  // A strfile gets a fresh index for fortune(6), and for reading it
+  // back without a scan.
+  if (!isOmifile && wantClose && bytesOut >= 0)
+    writeStrfileIndex(output.fileName(), strfileOffsets);
+
+  // The spans of a fresh .omi file were filled in as it was written;
+  // a mapped document follows the new file.
+  if (isOmifile && wantClose && bytesOut >= 0) {
+    if (mappedFile)
+      mapFile(output.fileName());
+    else if (!compressed)
+      setOrigin(output.fileName());
+    else
+      clearOrigin();
+  } else {
+    clearOrigin();
+  }
+  return bytesOut;
+}
+
+qint64 OmiDoc::compact() {
+  if (originFile.isEmpty())
+    return -1;
+
+  QString filename = originFile;
+  return replaceFile(filename);
+}
+
+qint64 OmiDoc::replaceFile(const QString &filename) {
+  // Write a fresh copy next to the old one and swap it in, which
+  // leaves any mapping of the old file intact until we remap, and
+  // any snapshot of it until that lets go.
+  QSaveFile output(filename);
+  if (!output.open(QIODevice::WriteOnly))
+    return -1;
+  QDataStream out(&output);
+  clearOrigin();
+  qint64 bytesOut = (compressed) ? writeCompressedOmifileToStream(out)
+    : writeOmifileToStream(out);
+  if (bytesOut < 0 || !output.commit()) {
+    clearOrigin();
+    return -1;
+  }
+
+  if (mappedFile)
+    mapFile(filename);
+  else if (!compressed)
+    setOrigin(filename);
+  else
+    clearOrigin();
+  return bytesOut;
+}
+
+int OmiDoc::reloadFromFile(const QString &filename) {
+  // The file is opened again the way the document was, and only held
+  // whole while the two are compared.
+  OmiDoc fresh;
+  bool mapped = isMapped();
+  qint64 bytesRead;
+  if (mapped) {
+    bytesRead = fresh.mapFile(filename);
+  } else {
+    QFile file(filename);
+    bytesRead = fresh.readFromFile(file);
+  }
+  if (bytesRead < 0)
+    return -1;
+
+  // A file rewritten in place shows through the old mapping as well,
+  // so there is nothing left to compare it with, and reading an entry
+  // past where the file now ends would fault.  Only a file renamed
+  // over the old one leaves the old one mapped, and so all that can
+  // be done otherwise is to start again from the new one.
+  if (mapped && (!fresh.mappedInode || (fresh.mappedDevice == mappedDevice
+                                         && fresh.mappedInode == mappedInode))) {
+    emit aboutToReset();
+    adoptFile(fresh, true);
+    emit reset();
+    return commentTableCount + fortuneTableCount;
+  }
+
+  Section sections[2] = { Comments, Fortunes };
+  ReloadPlan plans[2];
+  int changed = 0;
+  for (int t = 0; t < 2; t++) {
+    plans[t] = planReload(entryKeys(snapshot(sections[t])),
+                          entryKeys(fresh.snapshot(sections[t])));
+    for (const QPair<int, int> &run : std::as_const(plans[t].replaced))
+      changed += run.second;
+    changed += plans[t].removed + plans[t].inserted;
+  }
+
+  if (mapped) {
+    // Only the mapping changes hands, so entries coming or going are
+    // announced around that, and those replaced once it is done.
+    for (int t = 0; t < 2; t++)
+      if (plans[t].removed || plans[t].inserted)
+        emit entriesAboutToChange(sections[t], plans[t].index,
+                                  plans[t].removed, plans[t].inserted);
+    adoptFile(fresh, true);
+    for (int t = 0; t < 2; t++)
+      if (plans[t].removed || plans[t].inserted)
+        emit entriesChanged(sections[t], plans[t].index, plans[t].removed,
+                            plans[t].inserted);
+    for (int t = 0; t < 2; t++) {
+      for (const QPair<int, int> &run : std::as_const(plans[t].replaced)) {
+        emit entriesAboutToChange(sections[t], run.first, run.second,
+                                  run.second);
+        emit entriesChanged(sections[t], run.first, run.second, run.second);
+      }
+    }
+    return changed;
+  }
+
+  QByteArray buffer;
+  for (int t = 0; t < 2; t++) {
+    Section section = sections[t];
+    const ReloadPlan &plan = plans[t];
+    Snapshot entries = fresh.snapshot(section);
+    for (const QPair<int, int> &run : plan.replaced) {
+      emit entriesAboutToChange(section, run.first, run.second, run.second);
+      dropSpans(section, run.first, run.second);
+      QList<ArenaSpan> &list = entriesFor(section);
+      for (int i = run.first; i < run.first + run.second; i++) {
+        QByteArrayView bytes = entries.utf8At(i, buffer);
+        list[i] = arena.add(bytes.data(), bytes.size());
+      }
+      trackReplace(section, run.first, run.second);
+      emit entriesChanged(section, run.first, run.second, run.second);
+    }
+    if (plan.removed)
+      removeEntries(section, plan.index, plan.removed);
+    if (plan.inserted) {
+      QByteArrayList added;
+      added.reserve(plan.inserted);
+      for (int i = plan.index; i < plan.index + plan.inserted; i++)
+        added.append(entries.utf8At(i, buffer).toByteArray());
+      insertUtf8Entries(section, plan.index, added);
+    }
+  }
+  adoptFile(fresh, filename.endsWith(".omi"));
+  compactArena();
+  return changed;
+}
+
+void OmiDoc::adoptFile(OmiDoc &fresh, bool isOmifile) {
+  if (fresh.mappedFile) {
+    unmap();
+    mappedFile = fresh.mappedFile;
+    blocks = fresh.blocks;
+    mappedData = fresh.mappedData;
+    mappedSize = fresh.mappedSize;
+    hashIndex = fresh.hashIndex;
+    commentTable = fresh.commentTable;
+    commentTableCount = fresh.commentTableCount;
+    fortuneTable = fresh.fortuneTable;
+    fortuneTableCount = fresh.fortuneTableCount;
+    mappedWide = fresh.mappedWide;
+    mappedDevice = fresh.mappedDevice;
+    mappedInode = fresh.mappedInode;
+  }
+  if (isOmifile) {
+    compressed = fresh.compressed;
+    indexed = fresh.indexed;
+  }
+  // The new file's spans line up with the entries now, so the next
+  // save can still be a delta.
+  originFile = fresh.originFile;
+  originSize = fresh.originSize;
+  originIndexSize = fresh.originIndexSize;
+  originWide = fresh.originWide;
+  originModified = fresh.originModified;
+  commentOrigin = fresh.commentOrigin;
+  fortuneOrigin = fresh.fortuneOrigin;
+}
+
+qint64 OmiDoc::wastedBytes() const {
+  if (originFile.isEmpty())
+    return 0;
+
+  // Entries can share a payload, which only counts once.
+  qint64 live = omikujiHeaderSize(originWide) + originIndexSize;
+  QSet<TableEntry> counted;
+  auto count = [&live, &counted](const TableEntry &span) {
+    if (span.length && !counted.contains(span)) {
+      counted.insert(span);
+      live += span.length;
+    }
+  };
+  if (mappedFile) {
+    TableEntry entry;
+    live += (static_cast<qint64>(commentTableCount) + fortuneTableCount)
+      * tableEntrySize(originWide);
+    for (int i = 0; i < commentTableCount; i++)
+      if (mappedTableEntry(commentTable, commentTableCount, i, &entry))
+        count(entry);
+    for (int i = 0; i < fortuneTableCount; i++)
+      if (mappedTableEntry(fortuneTable, fortuneTableCount, i, &entry))
+        count(entry);
+  } else {
+    const Origin *origins[2] = { &commentOrigin, &fortuneOrigin };
+    for (const Origin *origin : origins) {
+      live += origin->table.length * tableEntrySize(originWide);
+      for (const TableEntry &span : origin->spans)
+        count(span);
+    }
+  }
+
+  return qMax<qint64>(0, originSize - live);
+}
+
+void OmiDoc::setOrigin(const QString &filename) {
+  QFileInfo info(filename);
+  originFile = info.canonicalFilePath();
+  originSize = info.size();
+  originModified = info.lastModified();
+  originIndexSize = OmiHashIndex::sizeInFile(originFile);
+}
+
+void OmiDoc::clearOrigin() {
+  originFile.clear();
+  originSize = 0;
+  originIndexSize = 0;
+  originWide = false;
+  originModified = QDateTime();
+  commentOrigin = Origin();
+  fortuneOrigin = Origin();
+}
+
+bool OmiDoc::isOriginFile(const QFile &file) const {
+  if (originFile.isEmpty())
+    return false;
+
+  // Somebody else writing to the file since we last looked means our
+  // spans cannot be trusted.
+  QFileInfo info(file);
+  if (info.canonicalFilePath() != originFile || info.size() != originSize
+      || info.lastModified() != originModified)
+    return false;
+
+  return mappedFile || (commentOrigin.spans.count() == commentEntries.count()
+                        && fortuneOrigin.spans.count() == fortuneEntries.count());
+}
+
+void OmiDoc::trackInsert(Section section, int index, int count) {
+  if (originFile.isEmpty()) return;
+  Origin &origin = originFor(section);
+  origin.spans.insert(index, count, TableEntry({ 0, 0 }));
+  origin.reordered = true;
+}
+
+void OmiDoc::trackRemove(Section section, int index, int count) {
+  if (originFile.isEmpty()) return;
+  Origin &origin = originFor(section);
+  origin.spans.remove(index, count);
+  origin.reordered = true;
+}
+
+void OmiDoc::trackReplace(Section section, int index, int count) {
+  if (originFile.isEmpty()) return;
+  QList<TableEntry> &spans = originFor(section).spans;
+  std::fill(spans.begin() + index, spans.begin() + index + count,
+            TableEntry({ 0, 0 }));
+}
+
+void OmiDoc::trackMove(Section section, int index, int count, int destination) {
+  if (originFile.isEmpty()) return;
+  // The payloads stay put; only the table order changes.
+  Origin &origin = originFor(section);
+  QList<TableEntry> &spans = origin.spans;
+  if (destination > index)
+    std::rotate(spans.begin() + index, spans.begin() + index + count,
+                spans.begin() + destination);
+  else
+    std::rotate(spans.begin() + destination, spans.begin() + index,
+                spans.begin() + index + count);
+  origin.reordered = true;
+}
+
+qint64 OmiDoc::writeDeltaToFile(QFile &output) {
+  // A mapped document has not been edited since it was mapped.
+  if (mappedFile)
+    return 0;
+
+  if (!output.open(QIODevice::ReadWrite))
+    return -1;
+
+  // New and changed payloads go on the end of the file.
+  qint64 end = output.size();
+  qint64 oldEnd = end;
+  qint64 bytesOut = 0;
+  QList<int> dirtyComments, dirtyFortunes;
+  qint64 written = appendDirtyPayloads(output, Comments, end, dirtyComments);
+  if (written >= 0) {
+    bytesOut += written;
+    written = appendDirtyPayloads(output, Fortunes, end, dirtyFortunes);
+  }
+  if (written < 0) {
+    // Past what a file with 32-bit offsets can reach, or a write
+    // failed: start over, which picks 64-bit offsets if need be.
+    output.close();
+    return writeWholeFile(output);
+  }
+  bytesOut += written;
+
+  // Then patch the tables, or write new ones if entries were added,
+  // removed or moved, and point the header at them.
+  bool headerChanged = false;
+  written = writeDeltaTable(output, Comments, dirtyComments, end, headerChanged);
+  if (written >= 0) {
+    bytesOut += written;
+    written = writeDeltaTable(output, Fortunes, dirtyFortunes, end, headerChanged);
+  }
+  if (written < 0) {
+    output.close();
+    return writeWholeFile(output);
+  }
+  bytesOut += written;
+  if (headerChanged) {
+    OmikujiHeader header;
+    char stored[maxOmikujiHeaderSize];
+    fillOmikujiHeader(&header, (originWide) ? omikuji_wide_version
+                      : omikuji_version, commentOrigin.table,
+                      fortuneOrigin.table);
+    qint64 size = storeOmikujiHeader(stored, header);
+    output.seek(0);
+    bytesOut += output.write(stored, size);
+  }
+
+  // The old index no longer matches.  A new one goes on the end; if
+  // there is to be none and nothing was added after the old one, its
+  // trailer's signature and version are wiped so that it is not
+  // believed.
+  if (bytesOut > 0 && indexed) {
+    bytesOut += writeDeltaIndex(output, end);
+  } else if (bytesOut > 0 && originIndexSize && end == oldEnd) {
+    char blank[8] = {};
+    output.seek(oldEnd - sizeof(blank));
+    bytesOut += output.write(blank, sizeof(blank));
+  }
+
+  output.close();
+  // Pick up the new size and time, keeping the spans.
+  setOrigin(output.fileName());
+  return bytesOut;
+}
+
+qint64 OmiDoc::appendDirtyPayloads(QFile &output, Section section, qint64 &end,
+                                   QList<int> &dirty) {
+  QByteArray buffer;
+  qint64 bytesOut = 0;
+
+  QList<TableEntry> &spans = originFor(section).spans;
+  if (!output.seek(end))
+    return -1;
+  for (int i = 0; i < spans.count(); i++) {
+    if (spans.at(i).offset != 0)
+      continue;
+    QByteArrayView bytes = entryUtf8(section, i, buffer);
+    if ((!originWide && !fitsNarrowOffsets(end + bytes.size()))
+        || output.write(bytes.data(), bytes.size()) != bytes.size())
+      return -1;
+    spans[i] = { static_cast<quint64>(end), static_cast<quint32>(bytes.size()) };
+    end += bytes.size();
+    bytesOut += bytes.size();
+    dirty.append(i);
+  }
+
+  return bytesOut;
+}
+
+qint64 OmiDoc::writeDeltaTable(QFile &output, Section section,
+                               const QList<int> &dirty, qint64 &end,
+                               bool &headerChanged) {
+  Origin &origin = originFor(section);
+  qint64 bytesOut = 0;
+  qint64 entrySize = tableEntrySize(originWide);
+  char stored[maxTableEntrySize];
+
+  if (!origin.reordered && origin.table.offset
+      && origin.table.length == static_cast<quint32>(origin.spans.count())) {
+    // Same entries in the same places: patch just the changed slots.
+    for (int i : dirty) {
+      storeTableEntry(stored, origin.spans.at(i), originWide);
+      output.seek(origin.table.offset + i * entrySize);
+      bytesOut += output.write(stored, entrySize);
+    }
+    return bytesOut;
+  }
+
+  if (origin.spans.isEmpty()) {
+    if (origin.table.offset || origin.table.length) {
+      origin.table = { 0, 0 };
+      headerChanged = true;
+    }
+    origin.reordered = false;
+    return 0;
+  }
+
+  // A whole new table, so long as a narrow file still ends below 4 GB.
+  qint64 size = origin.spans.count() * entrySize;
+  if (!originWide && !fitsNarrowOffsets(end + size))
+    return -1;
+  char table[tableBlockSize * maxTableEntrySize];
+  int used = 0;
+  output.seek(end);
+  for (int i = 0; i < origin.spans.count(); i++) {
+    storeTableEntry(table + used * entrySize, origin.spans.at(i), originWide);
+    if (++used == tableBlockSize || i == origin.spans.count() - 1) {
+      bytesOut += output.write(table, used * entrySize);
+      used = 0;
+    }
+  }
+  origin.table = { static_cast<quint64>(end),
+                   static_cast<quint32>(origin.spans.count()) };
+  origin.reordered = false;
+  end += size;
+  headerChanged = true;
   return bytesOut;
 }
 
+qint64 OmiDoc::writeDeltaIndex(QFile &output, qint64 end) {
+  // Every entry has a span by now, so only the digests need working
+  // out, from the bytes as they were written.
+  QByteArray buffer;
+  OmiHashIndexWriter index;
+  Section sections[2] = { Comments, Fortunes };
+  for (Section section : sections) {
+    const QList<TableEntry> &spans = originFor(section).spans;
+    for (int i = 0; i < spans.count(); i++) {
+      QByteArrayView bytes = entryUtf8(section, i, buffer);
+      index.add(section, payloadDigest(bytes.data(), bytes.size()),
+                spans.at(i));
+    }
+  }
+  if (!output.seek(end))
+    return 0;
+  QDataStream stream(&output);
+  return index.write(stream, end, originWide);
+}
+
+qint64 OmiDoc::omifileSizeBound() const {
+  // Sharing repeated payloads only makes a file smaller and qCompress()
+  // only makes a block a little bigger, so this errs on the big side.
+  qint64 entries = static_cast<qint64>(entryCount(Comments))
+    + entryCount(Fortunes);
+  qint64 payloads = 0;
+  Section sections[2] = { Comments, Fortunes };
+  for (Section section : sections) {
+    Snapshot snap = snapshot(section);
+    for (int i = 0; i < snap.count(); i++)
+      payloads += snap.sizeAt(i);
+  }
+  qint64 size = maxOmikujiHeaderSize + maxBlockHeaderSize
+    + entries * maxTableEntrySize + payloads;
+  if (compressed) {
+    qint64 blockCount = payloads / compressedBlockSize + 1;
+    size += payloads / 256 + blockCount * (64 + maxTableEntrySize);
+  }
+  if (indexed)
+    size += maxHashIndexTrailerSize + (4 * entries + 4) * hashSlotSize(true);
+  return size;
+}
+
 qint64 OmiDoc::writeOmifileToStream(QDataStream& stream) {
   qint64 bytesOut = 0;
 
   // Some handy variables for tracking things.
-  quint32 offset = 0;
-  quint32 comments = commentList->count();
-  quint32 fortunes = fortuneList->count();
+  bool wide = !fitsNarrowOffsets(omifileSizeBound());
+  qint64 offset = 0;
+  quint32 comments = entryCount(Comments);
+  quint32 fortunes = entryCount(Fortunes);
 
   // Make a header
   OmikujiHeader header;
-  std::memcpy(header.signature, omikuji_signature, 7);
-  header.version = omikuji_version;
+  commentOrigin.table = { 0, 0 };
+  fortuneOrigin.table = { 0, 0 };
   if (comments) {
-    offset = sizeof(OmikujiHeader);
-    header.commentHeader.offset = qToBigEndian<quint32>(offset);
-    header.commentHeader.length = qToBigEndian<quint32>(comments);
-    offset += comments * sizeof(TableEntry);
-  } else {
-    header.commentHeader.offset = 0;
-    header.commentHeader.length = 0;
+    offset = omikujiHeaderSize(wide);
+    commentOrigin.table = { static_cast<quint64>(offset), comments };
+    offset += comments * tableEntrySize(wide);
   }
   if (fortunes) {
-    header.fortuneHeader.offset = qToBigEndian<quint32>(offset);
-    header.fortuneHeader.length = qToBigEndian<quint32>(fortunes);
-    offset += fortunes * sizeof(TableEntry);
-  } else {
-    header.fortuneHeader.offset = 0;
-    header.fortuneHeader.length = 0;
+    if (!offset) offset = omikujiHeaderSize(wide);
+    fortuneOrigin.table = { static_cast<quint64>(offset), fortunes };
+    offset += fortunes * tableEntrySize(wide);
   }
+  originWide = wide;
+  fillOmikujiHeader(&header, (wide) ? omikuji_wide_version : omikuji_version,
+                    commentOrigin.table, fortuneOrigin.table);
   // Write it to the stream.
-  bytesOut += stream.writeRawData((const char*)&header,
-    sizeof(OmikujiHeader));
+  char stored[maxOmikujiHeaderSize];
+  bytesOut += stream.writeRawData(stored, storeOmikujiHeader(stored, header));
+
+  // First pass: the tables, from the encoded lengths alone.
+  Repeats repeats;
+  Repeats *dedup = (deduplicate) ? &repeats : nullptr;
+  if (comments)
+    bytesOut += writeOmifileTableToStream(stream, Comments, offset, dedup, wide);
+  if (fortunes)
+    bytesOut += writeOmifileTableToStream(stream, Fortunes, offset, dedup, wide);
 
-  // List to hold the UTF-8 comment and fortune output:
-  QList<QByteArray> *outputList = 0;
+  // Second pass: encode the payloads again, one at a time.
+  OmiHashIndexWriter index;
+  OmiHashIndexWriter *hashes = (indexed) ? &index : nullptr;
+  if (comments)
+    bytesOut += writeOmifilePayloadToStream(stream, Comments,
+                                            &repeats.entries[Comments], hashes);
+  if (fortunes)
+    bytesOut += writeOmifilePayloadToStream(stream, Fortunes,
+                                            &repeats.entries[Fortunes], hashes);
+
+  // The payloads end where the table pass left offset.
+  if (hashes && (comments || fortunes))
+    bytesOut += index.write(stream, offset, wide);
+
+  return bytesOut;
+}
+
+qint64 OmiDoc::writeCompressedOmifileToStream(QDataStream &stream) {
+  // The block header can only be filled in at the end, so this needs
+  // a device it can go back on.
+  QIODevice *device = stream.device();
+  if (!device || device->isSequential())
+    return -1;
+  qint64 start = device->pos();
+  qint64 bytesOut = 0;
 
-  // Write the comments table.
+  // The tables follow the two headers, and their payload offsets
+  // count from the start of the uncompressed payloads.
+  bool wide = !fitsNarrowOffsets(omifileSizeBound());
+  qint64 offset = omikujiHeaderSize(wide) + blockHeaderSize(wide);
+  quint32 comments = entryCount(Comments);
+  quint32 fortunes = entryCount(Fortunes);
+  commentOrigin.table = { 0, 0 };
+  fortuneOrigin.table = { 0, 0 };
   if (comments) {
-    if (!outputList)
-      outputList = new QList<QByteArray>();
-    TableEntry *commentTable = new TableEntry[comments];
-    for (quint32 i = 0; i < comments; i++) {
-      QString string = commentList->at(i);
-      QByteArray entry = string.toUtf8();
-      outputList->append(entry);
-      commentTable[i].offset = qToBigEndian<quint32>(offset);
-      commentTable[i].length = qToBigEndian<quint32>(entry.size());
-      offset += entry.size();
-    }
-    bytesOut += stream.writeRawData((const char*)commentTable,
-      comments * sizeof(TableEntry));
-    delete[] commentTable;
-  }
-
-  // Write the fortunes table.
+    commentOrigin.table = { static_cast<quint64>(offset), comments };
+    offset += comments * tableEntrySize(wide);
+  }
   if (fortunes) {
-    if (!outputList)
-      outputList = new QList<QByteArray>();
-    TableEntry *fortuneTable = new TableEntry[fortunes];
-    for (quint32 i = 0; i < fortunes; i++) {
-      QString string = fortuneList->at(i);
-      QByteArray entry = string.toUtf8();
-      outputList->append(entry);
-      fortuneTable[i].offset = qToBigEndian<quint32>(offset);
-      fortuneTable[i].length = qToBigEndian<quint32>(entry.size());
-      offset += entry.size();
+    fortuneOrigin.table = { static_cast<quint64>(offset), fortunes };
+    offset += fortunes * tableEntrySize(wide);
+  }
+  originWide = wide;
+  OmikujiHeader header;
+  fillOmikujiHeader(&header, (wide) ? omikuji_wide_compressed_version
+                    : omikuji_compressed_version, commentOrigin.table,
+                    fortuneOrigin.table);
+  BlockHeader blockHeader;
+  fillBlockHeader(&blockHeader, { 0, 0 }, compressedBlockSize, 0);
+  char stored[maxOmikujiHeaderSize + maxBlockHeaderSize];
+  qint64 headerSize = storeOmikujiHeader(stored, header);
+  qint64 size = headerSize + storeBlockHeader(stored + headerSize, blockHeader,
+                                              wide);
+  bytesOut += stream.writeRawData(stored, size);
+
+  qint64 payloadSize = 0;
+  Repeats repeats;
+  Repeats *dedup = (deduplicate) ? &repeats : nullptr;
+  if (comments)
+    bytesOut += writeOmifileTableToStream(stream, Comments, payloadSize, dedup,
+                                          wide);
+  if (fortunes)
+    bytesOut += writeOmifileTableToStream(stream, Fortunes, payloadSize, dedup,
+                                          wide);
+
+  // Payloads are gathered up into blocks, and the blocks compressed a
+  // few at a time on the thread pool.
+  QList<TableEntry> blockTable;
+  QByteArray pending;
+  qint64 blockOffset = device->pos() - start;
+  int flushSize = compressedBlockSize
+    * 2 * qMax(1, QThreadPool::globalInstance()->maxThreadCount());
+  bool failed = false;
+  auto flush = [&](bool all) {
+    QList<QByteArray> raw;
+    qsizetype used = 0;
+    while (pending.size() - used >= compressedBlockSize
+           || (all && used < pending.size())) {
+      raw.append(pending.mid(used, compressedBlockSize));
+      used += raw.last().size();
     }
-    bytesOut += stream.writeRawData((const char*)fortuneTable,
-      fortunes * sizeof(TableEntry));
-    delete[] fortuneTable;
+    pending.remove(0, used);
+    QList<QByteArray> packed = QtConcurrent::blockingMapped<QList<QByteArray>>(
+      raw, [](const QByteArray &block) { return qCompress(block); });
+    for (const QByteArray &block : packed) {
+      if (!wide && !fitsNarrowOffsets(blockOffset + block.size())) {
+        failed = true;
+        return;
+      }
+      blockTable.append({ static_cast<quint64>(blockOffset),
+                          static_cast<quint32>(block.size()) });
+      bytesOut += stream.writeRawData(block.constData(), block.size());
+      blockOffset += block.size();
+    }
+  };
+  OmiHashIndexWriter index;
+  OmiHashIndexWriter *hashes = (indexed) ? &index : nullptr;
+  Section sections[2] = { Comments, Fortunes };
+  for (Section section : sections) {
+    const QBitArray *skip = &repeats.entries[section];
+    bool digest = hashes != nullptr;
+    pipeBatches(entryCount(section),
+      [this, section, skip, digest](int first, int last) {
+        return encodeOmifileBatch(section, first, last, skip, digest);
+      },
+      [&](const EncodedBatch &batch) -> qint64 {
+        if (failed)
+          return 0;
+        if (hashes)
+          indexBatch(hashes, section, batch, skip);
+        pending.append(batch.bytes);
+        if (pending.size() >= flushSize)
+          flush(false);
+        return 0;
+      });
   }
+  if (!failed)
+    flush(true);
+  qint64 entrySize = tableEntrySize(wide);
+  if (failed
+      || (!wide && !fitsNarrowOffsets(blockOffset
+                                      + blockTable.count() * entrySize)))
+    return -1;
 
-  // Write the outputList.
-  if (outputList) {
-    QList<QByteArray>::const_iterator i;
-    for (i = outputList->constBegin(); i != outputList->constEnd(); i++)
-      bytesOut += stream.writeRawData(i->data(), i->size());
+  // The block table goes last, and then the block header can say
+  // where it is.
+  char table[tableBlockSize * maxTableEntrySize];
+  int used = 0;
+  for (int i = 0; i < blockTable.count(); i++) {
+    storeTableEntry(table + used * entrySize, blockTable.at(i), wide);
+    if (++used == tableBlockSize || i == blockTable.count() - 1) {
+      bytesOut += stream.writeRawData(table, used * entrySize);
+      used = 0;
+    }
+  }
+  if (hashes && (comments || fortunes))
+    bytesOut += index.write(stream, blockOffset + blockTable.count() * entrySize,
+                            wide);
+  qint64 end = device->pos();
+  fillBlockHeader(&blockHeader, { static_cast<quint64>(blockOffset),
+                                  static_cast<quint32>(blockTable.count()) },
+                  compressedBlockSize, payloadSize);
+  size = storeBlockHeader(stored, blockHeader, wide);
+  if (!device->seek(start + headerSize)
+      || device->write(stored, size) != size
+      || !device->seek(end))
+    return -1;
 
-    delete outputList;
+  return bytesOut;
+}
+
+qint64 OmiDoc::writeOmifileTableToStream(QDataStream &stream, Section section,
+                                         qint64 &offset, Repeats *repeats,
+                                         bool wide) {
+  qint64 bytesOut = 0;
+  qint64 entrySize = tableEntrySize(wide);
+  char table[tableBlockSize * maxTableEntrySize];
+  int used = 0;
+  // Remember where everything went, for later delta saves.
+  QList<TableEntry> &spans = originFor(section).spans;
+
+  int entries = entryCount(section);
+  spans.clear();
+  spans.reserve(entries);
+  if (repeats)
+    repeats->entries[section].resize(entries);
+  QByteArray buffer, other;
+  for (int i = 0; i < entries; i++) {
+    QByteArrayView bytes = entryUtf8(section, i, buffer);
+    TableEntry span = { static_cast<quint64>(offset), 0 };
+    bool repeated = false;
+    if (repeats) {
+      // An entry with the same bytes as one already written can point
+      // at that one's payload.
+      size_t hash = qHash(bytes);
+      for (auto it = repeats->written.constFind(hash);
+           it != repeats->written.constEnd() && it.key() == hash; ++it) {
+        if (sameBytes(entryUtf8(it->first, it->second, other), bytes)) {
+          span = originFor(it->first).spans.at(it->second);
+          repeats->entries[section].setBit(i);
+          repeated = true;
+          break;
+        }
+      }
+      if (!repeated)
+        repeats->written.insert(hash, qMakePair(section, i));
+    }
+    if (!repeated) {
+      span.length = static_cast<quint32>(bytes.size());
+      offset += bytes.size();
+    }
+    spans.append(span);
+    storeTableEntry(table + used * entrySize, span, wide);
+    if (++used == tableBlockSize || i == entries - 1) {
+      bytesOut += stream.writeRawData(table, used * entrySize);
+      used = 0;
+    }
   }
 
   return bytesOut;
 }
 
-qint64 OmiDoc::writeStrfileToStream(QDataStream &stream) {
+qint64 OmiDoc::writeOmifilePayloadToStream(QDataStream &stream, Section section,
+                                           const QBitArray *skip,
+                                           OmiHashIndexWriter *index) {
+  bool digest = index != nullptr;
+  return pipeBatches(entryCount(section),
+    [this, section, skip, digest](int first, int last) {
+      return encodeOmifileBatch(section, first, last, skip, digest);
+    },
+    [this, &stream, section, skip, index](const EncodedBatch &batch) -> qint64 {
+      if (index)
+        indexBatch(index, section, batch, skip);
+      return stream.writeRawData(batch.bytes.constData(), batch.bytes.size());
+    });
+}
+
+OmiDoc::EncodedBatch OmiDoc::encodeOmifileBatch(Section section, int first,
+                                                int last, const QBitArray *skip,
+                                                bool digest) const {
+  // Entries that repeat an earlier one have no payload of their own.
+  // Digests are worked out here, on the pool, while the bytes are hot.
+  QByteArray buffer;
+  EncodedBatch batch;
+  batch.first = first;
+  batch.last = last;
+  bool skipping = skip && !skip->isEmpty();
+  for (int i = first; i < last; i++) {
+    if (skipping && skip->testBit(i))
+      continue;
+    qsizetype at = batch.bytes.size();
+    batch.bytes.append(entryUtf8(section, i, buffer));
+    if (digest)
+      batch.digests.append(payloadDigest(batch.bytes.constData() + at,
+                                         batch.bytes.size() - at));
+  }
+  return batch;
+}
+
+void OmiDoc::indexBatch(OmiHashIndexWriter *index, Section section,
+                        const EncodedBatch &batch, const QBitArray *skip) {
+  // Repeats share the payload, and so the slot, of an earlier entry.
+  const QList<TableEntry> &spans = originFor(section).spans;
+  bool skipping = skip && !skip->isEmpty();
+  int digest = 0;
+  for (int i = batch.first; i < batch.last; i++)
+    if (!skipping || !skip->testBit(i))
+      index->add(section, batch.digests.at(digest++), spans.at(i));
+}
+
+qint64 OmiDoc::writeStrfileToStream(QDataStream &stream,
+                                    QList<quint64> *offsets) {
   qint64 bytesOut = 0;
   bool wantSeparator = false;
   const char *separator = "%\n";
 
-  if (commentList->count())
-    bytesOut += writeStringListToStrfileStream(stream, commentList, separator, wantSeparator);
-  if (fortuneList->count())
-    bytesOut += writeStringListToStrfileStream(stream, fortuneList, separator, wantSeparator);
+  if (offsets)
+    offsets->clear();
+  if (entryCount(Comments))
+    bytesOut += writeStrfileEntriesToStream(stream, Comments, separator,
+                                            wantSeparator, bytesOut, offsets);
+  if (entryCount(Fortunes))
+    bytesOut += writeStrfileEntriesToStream(stream, Fortunes, separator,
+                                            wantSeparator, bytesOut, offsets);
+  // As strfile(8) has it, the last offset is where the text ends.
+  if (offsets)
+    offsets->append(bytesOut);
 
   return bytesOut;
 }
@@ -232,181 +1490,516 @@ qint64 OmiDoc::writeStrfileToStream(QDataStream &stream) {
 qint64 OmiDoc::readFromFile(QFile &input) {
   bool wantClose = false;
   qint64 bytesRead = 0;
+  if (mappedFile) materialize();
+  // Only a document read into an empty one can be saved as a delta.
+  bool isFresh = commentEntries.isEmpty() && fortuneEntries.isEmpty();
+  clearOrigin();
+  if (!input.isOpen()) {
+    if (input.open(QIODevice::ReadOnly))
+      wantClose = true;
+    else
+      return -1;
+  }
   if (input.isReadable()) {
-    if (!input.isOpen()) {
-      if (input.open(QIODevice::ReadOnly))
-        wantClose = true;
-      else
-        return -1;
-    }
+    emit aboutToReset();
     if (input.fileName().endsWith(".omi")) {
-      bytesRead = readFromOmifile(input);
+      bool wasCompressed = false, wasIndexed = false;
+      bytesRead = readFromOmifile(input, &wasCompressed, &wasIndexed);
+      if (isFresh && bytesRead >= 0) {
+        compressed = wasCompressed;
+        indexed = wasIndexed;
+      }
+      if (isFresh && bytesRead >= 0 && !wasCompressed)
+        setOrigin(input.fileName());
+      else
+        clearOrigin();
     } else {
       bytesRead = readFromStrfile(input);
     }
-    if (bytesRead > 0) {
-      emit commentsAdded(*commentList);
-      emit fortunesAdded(*fortuneList);
-    }
+    emit reset();
   }
   if (wantClose) input.close();
   return bytesRead;
 }
 
-qint64 OmiDoc::readFromOmifile(QFile &file) {
+qint64 OmiDoc::readFromOmifile(QFile &file, bool *wasCompressed,
+                               bool *wasIndexed) {
   qint64 len = file.size();
-  char *data = new char[len];
-  if (!data) return -1;
-  len = file.read(data, len);
-  if (len < file.size()) {
-    delete[] data;
-    return -1;
+  if (len < omikujiHeaderSize(false))
+    return 0;
+
+  // Map the file if we can, rather than copying all of it.
+  uchar *mapped = file.map(0, len);
+  char *buffer = nullptr;
+  const char *data = reinterpret_cast<const char*>(mapped);
+  if (!mapped) {
+    buffer = new char[len];
+    if (file.read(buffer, len) < len) {
+      delete[] buffer;
+      return -1;
+    }
+    data = buffer;
   }
 
   qint64 bytesRead = 0;
-  if (static_cast<unsigned long>(len) >= sizeof(OmikujiHeader)) {
-    // Minimum size of an omikuji file is 24 bytes for the header.
-    OmikujiHeader header;
-    std::memcpy(&header, data, sizeof(OmikujiHeader));
-    if (checkOmikujiHeader(header)) {
-      // Fix the other header fields.
-      header.commentHeader.offset =
-      qFromBigEndian<quint32>(header.commentHeader.offset);
-      header.commentHeader.length =
-      qFromBigEndian<quint32>(header.commentHeader.length);
-      header.fortuneHeader.offset =
-      qFromBigEndian<quint32>(header.fortuneHeader.offset);
-      header.fortuneHeader.length =
-      qFromBigEndian<quint32>(header.fortuneHeader.length);
-
-      // Check for and copy comments.
-      if (header.commentHeader.offset && header.commentHeader.length) {
-        quint32 offset = header.commentHeader.offset;
-        TableEntry entry;
-        for (quint32 i = 0; i < header.commentHeader.length; i++) {
-          if (offset >= sizeof(OmikujiHeader) &&
-              offset + sizeof(TableEntry) <= static_cast<unsigned long>(len)) {
-            copyTableEntry(&entry, data, offset);
-            if (entry.offset >= sizeof(OmikujiHeader)
-                && entry.offset + entry.length <= static_cast<unsigned long>(len)) {
-              QString str = QString::fromUtf8((data + entry.offset),
-                                              entry.length);
-              this->addComment(str);
-              bytesRead += entry.length;
-            }
-          }
-          offset += sizeof(TableEntry);
-        }
-      }
-
-      // Ditto for the fortunes.
-      if (header.fortuneHeader.offset && header.fortuneHeader.length) {
-        quint32 offset = header.fortuneHeader.offset;
-        TableEntry entry;
-        for (quint32 i = 0; i < header.fortuneHeader.length; i++) {
-          if (offset >= sizeof(OmikujiHeader)
-              && offset + sizeof(TableEntry) <= static_cast<unsigned long>(len)) {
-            copyTableEntry(&entry, data, offset);
-            if (entry.offset >= sizeof(OmikujiHeader)
-                && entry.offset + entry.length <= len) {
-              QString str = QString::fromUtf8((data + entry.offset),
-                                              entry.length);
-              this->addFortune(str);
-              bytesRead += entry.length;
-            }
-          }
-          offset += sizeof(TableEntry);
-        }
-      }
+  // Minimum size of an omikuji file is 24 bytes for the header.
+  OmikujiHeader header;
+  if (readOmikujiHeader(&header, data, len)) {
+    bool wide = isWideVersion(header.version);
+    commentOrigin.table = header.commentHeader;
+    fortuneOrigin.table = header.fortuneHeader;
+    originWide = wide;
 
+    BlockHeader blockHeader;
+    OmiBlocks *fileBlocks = nullptr;
+    *wasCompressed = isCompressedVersion(header.version);
+    *wasIndexed = OmiHashIndex().open(reinterpret_cast<const uchar*>(data), len);
+    if (*wasCompressed) {
+      if (readBlockHeader(&blockHeader, data, len, wide))
+        fileBlocks = new OmiBlocks(data, len, blockHeader, wide);
+      else
+        bytesRead = -1;
     }
+    if (bytesRead >= 0) {
+      QList<ArenaSpan> *lists[2] = { &commentEntries, &fortuneEntries };
+      int firsts[2] = { static_cast<int>(commentEntries.count()),
+                        static_cast<int>(fortuneEntries.count()) };
+      const QList<TableEntry> *spans[2] = { &commentOrigin.spans,
+                                            &fortuneOrigin.spans };
+      int spanFirsts[2] = { static_cast<int>(commentOrigin.spans.count()),
+                            static_cast<int>(fortuneOrigin.spans.count()) };
+      bytesRead += readOmifileTable(data, len, fileBlocks, header.commentHeader,
+                                    wide, commentEntries, commentOrigin.spans);
+      bytesRead += readOmifileTable(data, len, fileBlocks, header.fortuneHeader,
+                                    wide, fortuneEntries, fortuneOrigin.spans);
+      deadBytes += shareRepeatedEntries(lists, firsts, spans, spanFirsts);
+      compactArena();
+    }
+    delete fileBlocks;
   }
 
-  if (data) delete[] data;
+  if (mapped) file.unmap(mapped);
+  delete[] buffer;
+
+  return bytesRead;
+}
+
+qint64 OmiDoc::readOmifileTable(const char *data, qint64 len,
+                                const OmiBlocks *blocks,
+                                const TableEntry &table, bool wide,
+                                QList<ArenaSpan> &entries,
+                                QList<TableEntry> &spans) {
+  if (!table.offset || !table.length
+      || table.offset >= static_cast<quint64>(len))
+    return 0;
+  // A damaged header can claim far more entries than the file holds;
+  // only those that fit are read, as with a mapped file.
+  quint32 count = static_cast<quint32>(qMin<quint64>(
+    table.length, (len - table.offset) / tableEntrySize(wide)));
+
+  // Every entry's offset and length are known up front, so split the
+  // table into ranges, decode them on the thread pool and stitch the
+  // results back together in order.
+  QList<QFuture<DecodedRange>> futures;
+  if (count > decodeRangeSize) {
+    for (quint32 first = 0; first < count; first += decodeRangeSize) {
+      quint32 last = first + qMin(decodeRangeSize, count - first);
+      futures.append(QtConcurrent::run(decodeTableRange, data, len, blocks,
+                                       table.offset, first, last, wide));
+    }
+  }
 
+  // Each range brings its own arena, whose chunks are taken over
+  // rather than copied.  Nothing after a damaged entry is kept, but
+  // every range is waited for, since they all read the file.
+  qint64 bytesRead = 0;
+  bool damaged = false;
+  entries.reserve(entries.count() + count);
+  spans.reserve(spans.count() + count);
+  auto append = [&](DecodedRange range) {
+    if (damaged)
+      return;
+    damaged = range.damaged;
+    qsizetype first = entries.count();
+    entries.append(std::move(range.entries));
+    arena.absorb(std::move(range.arena), entries, first);
+    spans.append(std::move(range.spans));
+    bytesRead += range.bytesRead;
+  };
+  if (futures.isEmpty())
+    append(decodeTableRange(data, len, blocks, table.offset, 0, count,
+                            wide));
+  for (QFuture<DecodedRange> &future : futures)
+    append(future.takeResult());
   return bytesRead;
 }
 
 qint64 OmiDoc::readFromStrfile(QFile &file) {
-  qint64 size = file.size();
-  if (size > 0) {
-    char *data = new char[size + 1];
-    if (!data) return -1;
-    qint64 length = file.read(data, size);
-    if (length < size) {
-      delete[] data;
-      return -1;
+  // With an index from strfile(8) that still goes with the file, the
+  // entries are cut out of it where the index says, without a scan.
+  QList<quint64> offsets;
+  if (file.pos() == 0 && !file.fileName().isEmpty()
+      && readStrfileIndex(file.fileName(), &offsets)) {
+    qint64 bytesRead = readIndexedStrfile(file, offsets);
+    if (bytesRead >= 0)
+      return bytesRead;
+  }
+
+  // The entries go into the arena as they are, without being decoded.
+  StrfileReader reader(&file);
+  QByteArrayList batch;
+  qint64 bytesRead = reader.read([this, &batch](const char *data, qsizetype length) {
+    batch.append(QByteArray(data, length));
+    if (batch.count() >= strfileBatchSize) {
+      insertUtf8Entries(Fortunes, fortuneCount(), batch);
+      batch.clear();
     }
-    else {
-      data[length] = 0;
-      char *start = data;
-      while (true) {
-        char *next = std::strstr(start, "\n%\n");
-        if (next) {
-          length = next - start + 1;
-          if (length > 1) {
-            QString str = QString::fromUtf8(start, length);
-            this->addFortune(str);
-          }
-          start = next + 3;
-          if (start >= (data + size)) break;
-        } else {
-          length = std::strlen(start);
-          if (length > 0) {
-            QString str = QString::fromUtf8(start, length);
-            this->addFortune(str);
+    return true;
+  });
+  insertUtf8Entries(Fortunes, fortuneCount(), batch);
+  return bytesRead;
+}
+
+qint64 OmiDoc::readIndexedStrfile(QFile &file, const QList<quint64> &offsets) {
+  qint64 len = file.size();
+  if (!len)
+    return 0;
+  uchar *mapped = file.map(0, len);
+  if (!mapped)
+    return -1;
+  const char *data = reinterpret_cast<const char*>(mapped);
+
+  // Every entry's place is known, so ranges of them are cut out on the
+  // thread pool and stitched back together in order, as with a table.
+  int count = offsets.count() - 1;
+  QList<QFuture<DecodedRange>> futures;
+  if (count > static_cast<int>(decodeRangeSize)) {
+    for (int first = 0; first < count; first += decodeRangeSize) {
+      int last = first + qMin<int>(decodeRangeSize, count - first);
+      futures.append(QtConcurrent::run(decodeStrfileRange, data, &offsets,
+                                       first, last));
+    }
+  }
+
+  QList<ArenaSpan> spans;
+  spans.reserve(count);
+  auto append = [&](DecodedRange range) {
+    qsizetype first = spans.count();
+    spans.append(std::move(range.entries));
+    arena.absorb(std::move(range.arena), spans, first);
+  };
+  if (futures.isEmpty())
+    append(decodeStrfileRange(data, &offsets, 0, count));
+  for (QFuture<DecodedRange> &future : futures)
+    append(future.takeResult());
+  file.unmap(mapped);
+
+  if (!spans.isEmpty())
+    insertSpans(Fortunes, fortuneCount(), std::move(spans));
+  return len;
+}
+
+qint64 OmiDoc::writeStrfileEntriesToStream(QDataStream &stream, Section section,
+                                           const char *separator, bool &wantSeparator,
+                                           qint64 position, QList<quint64> *offsets) {
+  qint64 separatorSize = std::strlen(separator);
+  return pipeBatches(entryCount(section),
+    [this, section, separator](int first, int last) {
+      return encodeStrfileBatch(section, first, last, separator);
+    },
+    [&](const StrfileBatch &batch) -> qint64 {
+      // Batches only separate their own entries, so the one that goes
+      // between this batch and the last is up to us.
+      qint64 bytesOut = 0;
+      if (batch.bytes.size() > 0) {
+        if (wantSeparator)
+          bytesOut += stream.writeRawData(separator, separatorSize);
+        qint64 start = position + bytesOut;
+        bytesOut += stream.writeRawData(batch.bytes.constData(),
+                                        batch.bytes.size());
+        wantSeparator = true;
+        if (offsets) {
+          for (quint32 length : batch.lengths) {
+            offsets->append(start);
+            start += length + separatorSize;
           }
-          break;
         }
       }
-      delete[] data;
+      position += bytesOut;
+      return bytesOut;
+    });
+}
+
+OmiDoc::StrfileBatch OmiDoc::encodeStrfileBatch(Section section, int first,
+                                                int last,
+                                                const char *separator) const {
+  QByteArray buffer;
+  StrfileBatch batch;
+  for (int i = first; i < last; i++) {
+    QByteArrayView bytes = entryUtf8(section, i, buffer);
+    if (bytes.isEmpty())
+      continue;
+    if (batch.bytes.size() > 0)
+      batch.bytes.append(separator);
+    qsizetype start = batch.bytes.size();
+    batch.bytes.append(bytes);
+    if (batch.bytes.back() != '\n')
+      batch.bytes.append('\n');
+    batch.lengths.append(batch.bytes.size() - start);
+  }
+  return batch;
+}
+
+// Encodes entries in batches on the global thread pool and passes the
+// results to write() in order.  Only a couple of batches per thread
+// are ever in flight, so memory use does not grow with the document.
+template <typename Encoder, typename Writer>
+qint64 pipeBatches(int entries, Encoder encode, Writer write) {
+  if (entries <= encodeBatchSize)
+    return (entries > 0) ? write(encode(0, entries)) : 0;
+
+  QThreadPool *pool = QThreadPool::globalInstance();
+  int window = 2 * qMax(1, pool->maxThreadCount());
+  QQueue<QFuture<decltype(encode(0, 0))>> pending;
+  qint64 bytesOut = 0;
+  int next = 0;
+
+  while (next < entries || !pending.isEmpty()) {
+    while (next < entries && pending.size() < window) {
+      int last = qMin(entries, next + encodeBatchSize);
+      pending.enqueue(QtConcurrent::run(pool, encode, next, last));
+      next = last;
     }
+    bytesOut += write(pending.head().result());
+    pending.dequeue();
   }
-  return size;
+
+  return bytesOut;
 }
 
-bool checkOmikujiHeader(const OmikujiHeader header) {
-  bool isValid = false;
+static QList<EntryKey> entryKeys(const OmiDoc::Snapshot &entries) {
+  QList<int> starts;
+  for (int first = 0; first < entries.count(); first += decodeRangeSize)
+    starts.append(first);
+  QList<QList<EntryKey>> ranges =
+    QtConcurrent::blockingMapped<QList<QList<EntryKey>>>(starts,
+      [&entries](int first) {
+        QList<EntryKey> keys;
+        QByteArray buffer;
+        int last = qMin<int>(first + decodeRangeSize, entries.count());
+        keys.reserve(last - first);
+        for (int i = first; i < last; i++) {
+          QByteArrayView bytes = entries.utf8At(i, buffer);
+          keys.append({ bytes.size(), payloadDigest(bytes.data(), bytes.size()) });
+        }
+        return keys;
+      });
 
-  // Only support 1 version of omikji files, since only 1 exists.
-  if (header.version == omikuji_version) {
-    isValid = true;
-    for (int i = 0; i < 7; i++) {
-      if (header.signature[i] != omikuji_signature[i]) {
-        isValid = false;
-        break;
-      }
+  QList<EntryKey> keys;
+  keys.reserve(entries.count());
+  for (const QList<EntryKey> &range : std::as_const(ranges))
+    keys.append(range);
+  return keys;
+}
+
+static void fileIdentity(const QString &filename, quint64 *device,
+                         quint64 *inode) {
+  *device = *inode = 0;
+#ifdef Q_OS_UNIX
+  struct stat info;
+  if (::stat(QFile::encodeName(filename).constData(), &info) == 0) {
+    *device = info.st_dev;
+    *inode = info.st_ino;
+  }
+#else
+  Q_UNUSED(filename);
+#endif
+}
+
+static ReloadPlan planReload(const QList<EntryKey> &before,
+                             const QList<EntryKey> &after) {
+  int n = before.count(), m = after.count();
+  int prefix = 0;
+  while (prefix < n && prefix < m && before.at(prefix) == after.at(prefix))
+    prefix++;
+  int suffix = 0;
+  while (suffix < n - prefix && suffix < m - prefix
+         && before.at(n - 1 - suffix) == after.at(m - 1 - suffix))
+    suffix++;
+
+  // Between the two, entries are paired off as far as both go.
+  ReloadPlan plan;
+  int paired = qMin(n, m) - suffix;
+  for (int i = prefix; i < paired; ) {
+    if (before.at(i) == after.at(i)) {
+      i++;
+      continue;
     }
+    int first = i;
+    while (i < paired && !(before.at(i) == after.at(i)))
+      i++;
+    plan.replaced.append({ first, i - first });
   }
+  plan.index = paired;
+  plan.removed = n - suffix - paired;
+  plan.inserted = m - suffix - paired;
+  return plan;
+}
 
-  return isValid;
+static DecodedRange decodeStrfileRange(const char *data,
+                                       const QList<quint64> *offsets,
+                                       int first, int last) {
+  DecodedRange range;
+  range.arena.reserve(offsets->at(last) - offsets->at(first));
+  range.entries.reserve(last - first);
+  StrfileReader::Sink sink = [&range](const char *entry, qsizetype length) {
+    range.entries.append(range.arena.add(entry, length));
+    return true;
+  };
+  for (int i = first; i < last; i++) {
+    qint64 length = offsets->at(i + 1) - offsets->at(i);
+    StrfileReader::readEntry(data + offsets->at(i), length, sink);
+    range.bytesRead += length;
+  }
+  return range;
 }
 
-TableEntry *copyTableEntry(TableEntry *entry, char *data, quint32 offset) {
-  std::memcpy(entry, (data + offset), sizeof(TableEntry));
-  entry->offset = qFromBigEndian<quint32>(entry->offset);
-  entry->length = qFromBigEndian<quint32>(entry->length);
-  return entry;
+DecodedRange decodeTableRange(const char *data, qint64 len,
+                              const OmiBlocks *blocks, quint64 table,
+                              quint32 first, quint32 last, bool wide) {
+  DecodedRange range;
+  range.spans.reserve(last - first);
+
+  // Reading stops at the first entry that points outside the file, as
+  // it does for a mapped file.  The spans come first, so that the
+  // arena can be sized to take every payload in one go.
+  qint64 entrySize = tableEntrySize(wide);
+  qint64 headerSize = omikujiHeaderSize(wide);
+  qint64 payloadEnd = (blocks) ? blocks->payloadSize() : len;
+  qint64 payloadStart = (blocks) ? 0 : headerSize;
+  qint64 bytes = 0;
+  TableEntry entry;
+  if (table > static_cast<quint64>(len))
+    return range;
+  qint64 offset = table + static_cast<qint64>(first) * entrySize;
+  for (quint32 i = first; i < last; i++) {
+    if (offset < headerSize || offset + entrySize > len) {
+      range.damaged = true;
+      break;
+    }
+    copyTableEntry(&entry, data, offset, wide);
+    if (entry.offset < static_cast<quint64>(payloadStart)
+        || entry.offset > static_cast<quint64>(payloadEnd)
+        || static_cast<qint64>(entry.offset) + entry.length > payloadEnd) {
+      range.damaged = true;
+      break;
+    }
+    range.spans.append(entry);
+    bytes += entry.length;
+    offset += entrySize;
+  }
+
+  range.arena.reserve(bytes);
+  range.entries.reserve(range.spans.count());
+  for (const TableEntry &span : range.spans) {
+    if (blocks) {
+      QByteArray payload = blocks->payload(span.offset, span.length);
+      range.entries.append(range.arena.add(payload.constData(), payload.size()));
+    } else {
+      range.entries.append(range.arena.add(data + span.offset, span.length));
+    }
+  }
+  range.bytesRead = bytes;
+
+  return range;
 }
 
-qint64 writeStringListToStrfileStream(QDataStream &stream, QStringList *list,
-                                      const char *separator, bool &wantSeparator) {
-  qint64 bytesOut = 0;
+static bool mappedEntry(const uchar *data, qint64 size, const OmiBlocks *blocks,
+                        quint64 table, int count, int i, TableEntry *entry,
+                        bool wide) {
+  if (blocks)
+    return tableEntryAt(data, table, count, i, entry, 0, blocks->payloadSize(),
+                        wide);
+  return tableEntryAt(data, table, count, i, entry, omikujiHeaderSize(wide),
+                      size, wide);
+}
 
-  quint32 entries = list->count();
-  if (entries) {
-    for (quint32 i = 0; i < entries; i++) {
-      QString string = list->at(i);
-      QByteArray entry = string.toUtf8();
-      if (entry.size() > 0) {
-        if (wantSeparator)
-          bytesOut += stream.writeRawData(separator, std::strlen(separator));
-        bytesOut += stream.writeRawData(entry.data(), entry.size());
-        if (!string.endsWith("\n"))
-          bytesOut += stream.writeRawData("\n", 1);
-        wantSeparator = true;
+static QString mappedString(const uchar *data, const OmiBlocks *blocks,
+                            const TableEntry &entry) {
+  if (blocks)
+    return QString::fromUtf8(blocks->payload(entry.offset, entry.length));
+  return QString::fromUtf8(reinterpret_cast<const char*>(data) + entry.offset,
+                           entry.length);
+}
+
+static QByteArray mappedBytes(const uchar *data, const OmiBlocks *blocks,
+                              const TableEntry &entry) {
+  if (blocks)
+    return blocks->payload(entry.offset, entry.length);
+  return QByteArray(reinterpret_cast<const char*>(data) + entry.offset,
+                    entry.length);
+}
+
+static bool mappedEquals(const uchar *data, qint64 size, const OmiBlocks *blocks,
+                         const TableEntry &entry, const QByteArray &bytes,
+                         bool wide) {
+  // The entry may come from the hash index rather than a table, so it
+  // is checked here.
+  if (entry.length != static_cast<quint32>(bytes.size()))
+    return false;
+  if (blocks)
+    return entry.offset <= static_cast<quint64>(blocks->payloadSize())
+      && static_cast<qint64>(entry.offset) + entry.length <= blocks->payloadSize()
+      && blocks->payload(entry.offset, entry.length) == bytes;
+  return entry.offset >= static_cast<quint64>(omikujiHeaderSize(wide))
+    && entry.offset <= static_cast<quint64>(size)
+    && static_cast<qint64>(entry.offset) + entry.length <= size
+    && std::memcmp(data + entry.offset, bytes.constData(), bytes.size()) == 0;
+}
+
+static bool sameBytes(QByteArrayView a, QByteArrayView b) {
+  return a.size() == b.size()
+    && (a.isEmpty() || std::memcmp(a.data(), b.data(), a.size()) == 0);
+}
+
+static qint64 shareRepeatedEntries(QList<ArenaSpan> *lists[2], int firsts[2],
+                                   const QList<TableEntry> *spans[2],
+                                   int spanFirsts[2]) {
+  // Payloads are written in table order, so unless some entry starts
+  // before the end of the one ahead of it, nothing is shared and the
+  // hashing can be skipped.
+  bool looksBack = false;
+  qint64 end = 0;
+  for (int t = 0; t < 2 && !looksBack; t++) {
+    for (int i = spanFirsts[t]; i < spans[t]->count(); i++) {
+      const TableEntry &span = spans[t]->at(i);
+      if (span.length && span.offset < end) {
+        looksBack = true;
+        break;
       }
+      end = qMax<qint64>(end, static_cast<qint64>(span.offset) + span.length);
     }
   }
-  return bytesOut;
+  if (!looksBack)
+    return 0;
+
+  qint64 freed = 0;
+  QHash<TableEntry, ArenaSpan> seen;
+  for (int t = 0; t < 2; t++) {
+    QList<ArenaSpan> &list = *lists[t];
+    for (int i = spanFirsts[t]; i < spans[t]->count(); i++) {
+      const TableEntry &span = spans[t]->at(i);
+      if (!span.length)
+        continue;
+      int row = firsts[t] + i - spanFirsts[t];
+      auto it = seen.constFind(span);
+      if (it != seen.constEnd()) {
+        freed += list.at(row).length;
+        list[row] = *it;
+      } else {
+        seen.insert(span, list.at(row));
+      }
+    }
+  }
+  return freed;
 }
@@ -22,24 +22,115 @@
 #include <QObject>
 #include <QString>
 #include <QStringList>
+#include <QByteArrayList>
 #include <QDataStream>
 #include <QFile>
+#include <QCache>
+#include <QHash>
+#include <QBitArray>
+#include <QDateTime>
+#include <QList>
+#include <QSharedPointer>
+#include "omiformat.hh"
+#include "omiblocks.hh"
+#include "omihashindex.hh"
+#include "utf8arena.hh"
 
 class OmiDoc : public QObject
 {
   Q_OBJECT
 
 public:
+  enum Section { Comments, Fortunes };
+  Q_ENUM(Section)
+
+  // A read-only copy of one section that worker threads can go
+  // through while the document carries on being edited.  A snapshot
+  // of a mapped document keeps the mapping alive until it is gone.
+  class Snapshot
+  {
+  public:
+    Snapshot()
+      : data(nullptr), size(0), table(0), tableCount(0), wide(false) {}
+    int count() const;
+    QString at(int) const;
+    // The UTF-8 length of an entry, without decoding a mapped one.
+    qint64 sizeAt(int) const;
+    // The UTF-8 payload of an entry, straight from the mapping or
+    // the arena, or nullptr for a compressed one.
+    const char *payloadAt(int, quint32*) const;
+    QByteArray bytesAt(int) const;
+    // payloadAt where it can, or else the entry decompressed into the
+    // buffer.
+    QByteArrayView utf8At(int, QByteArray&) const;
+    bool isCompressed() const { return !blocks.isNull(); }
+
+  private:
+    friend class OmiDoc;
+    Utf8Arena arena;
+    QList<ArenaSpan> entries;
+    QSharedPointer<QFile> file;
+    QSharedPointer<OmiBlocks> blocks;
+    const uchar *data;
+    qint64 size;
+    quint64 table;
+    int tableCount;
+    bool wide;
+  };
+
   OmiDoc(QObject *parent = nullptr)
-    : QObject(parent), commentList(new QStringList()),
-      fortuneList(new QStringList()) {}
+    : QObject(parent), deadBytes(0), mappedData(nullptr), mappedSize(0), commentTable(0),
+      commentTableCount(0), fortuneTable(0), fortuneTableCount(0),
+      mappedWide(false), mappedDevice(0), mappedInode(0),
+      decodedCache(4 * 1024 * 1024), compressed(false), deduplicate(false),
+      indexed(false), originSize(0), originIndexSize(0), originWide(false) {}
   ~OmiDoc();
-  const QString& commentAt(int);
-  const QString& fortuneAt(int);
+  QString commentAt(int);
+  QString fortuneAt(int);
   int commentCount();
   int fortuneCount();
+  // For walking a whole section; these skip the decoded cache.
+  int entryCount(Section) const;
+  QString entryAt(Section, int) const;
+  Snapshot snapshot(Section) const;
+  // Range edits, each sent as a single change.
+  void insertEntries(Section, int, QStringList&&);
+  void removeEntries(Section, int, int);
+  void replaceEntries(Section, int, QStringList&&);
+  void moveEntries(Section, int, int, int);
+  // Inserts entries that are already UTF-8, as read from a file.
+  void insertUtf8Entries(Section, int, const QByteArrayList&);
   qint64 writeToFile(QFile&);
   qint64 readFromFile(QFile&);
+  qint64 mapFromFile(const QString&);
+  bool isMapped() const { return !mappedFile.isNull(); }
+  void setDecodedCacheSize(int chars) { decodedCache.setMaxCost(chars); }
+  // Whether .omi files are written with their payloads compressed.
+  // A document read from a compressed file starts out that way.
+  bool isCompressed() const { return compressed; }
+  void setCompressed(bool on) { compressed = on; }
+  // Whether entries with the same text share one copy of it when
+  // written to an .omi file.
+  bool isDeduplicated() const { return deduplicate; }
+  void setDeduplicated(bool on) { deduplicate = on; }
+  // Whether .omi files are written with a hash index on the end.  A
+  // document read from a file with one starts out that way.
+  bool isIndexed() const { return indexed; }
+  void setIndexed(bool on) { indexed = on; }
+  // Whether a section holds an entry of exactly this text.  A mapped
+  // file with a hash index answers from the index and the one payload
+  // it points at.
+  bool contains(Section, const QString&) const;
+  qint64 wastedBytes() const;
+  qint64 compact();
+  // Brings a document read from filename up to date after somebody
+  // else has rewritten it.  Entries are compared by length and hash,
+  // and only those that differ are replaced, inserted or removed, so
+  // that views keep their place.  A mapped file that was rewritten in
+  // place, rather than replaced, is mapped again from scratch, with a
+  // reset.  Returns how many entries changed, or -1 if the file could
+  // not be read.
+  int reloadFromFile(const QString&);
 
 public slots:
   void addComment(QString&);
@@ -52,16 +143,134 @@ public slots:
   void insertFortune(int, QString&);
 
 signals:
-  void commentsAdded(const QStringList&);
-  void fortunesAdded(const QStringList&);
+  // Sent around every change, so that models can follow along.  At
+  // index, removed entries were replaced by inserted new ones.
+  void entriesAboutToChange(OmiDoc::Section section, int index, int removed,
+                            int inserted);
+  void entriesChanged(OmiDoc::Section section, int index, int removed,
+                      int inserted);
+  // Moves count entries from index to before destination, counted
+  // before the move, as with QAbstractItemModel::beginMoveRows().
+  void entriesAboutToMove(OmiDoc::Section section, int index, int count,
+                          int destination);
+  void entriesMoved(OmiDoc::Section section, int index, int count,
+                    int destination);
+  // Sent around reading a whole new document.
+  void aboutToReset();
+  void reset();
 
 private:
-  QStringList *commentList;
-  QStringList *fortuneList;
+  // The entries of both sections, as spans of one arena.  Removed and
+  // replaced entries leave their bytes behind until there are enough
+  // of them to be worth copying the live ones into a fresh arena.
+  Utf8Arena arena;
+  QList<ArenaSpan> commentEntries;
+  QList<ArenaSpan> fortuneEntries;
+  qint64 deadBytes;
+  QList<ArenaSpan> &entriesFor(Section section)
+    { return (section == Comments) ? commentEntries : fortuneEntries; }
+  const QList<ArenaSpan> &entriesFor(Section section) const
+    { return (section == Comments) ? commentEntries : fortuneEntries; }
+  void insertSpans(Section, int, QList<ArenaSpan>&&);
+  void dropSpans(Section, int, int);
+  void compactArena();
+  void clearEntries();
+  QByteArrayView entryUtf8(Section, int, QByteArray&) const;
+  // For a deduplicating save: the entries written so far, by the hash
+  // of their text, and which entries point back at one of them.
+  struct Repeats {
+    QMultiHash<size_t, QPair<Section, int>> written;
+    QBitArray entries[2];
+  };
   qint64 writeOmifileToStream(QDataStream&);
-  qint64 writeStrfileToStream(QDataStream&);
-  qint64 readFromOmifile(QFile&);
+  qint64 writeCompressedOmifileToStream(QDataStream&);
+  qint64 writeOmifileTableToStream(QDataStream&, Section, qint64&, Repeats*,
+                                   bool);
+  // The most an .omi file of the document could take up, which
+  // decides whether it needs 64-bit offsets.
+  qint64 omifileSizeBound() const;
+  qint64 writeOmifilePayloadToStream(QDataStream&, Section, const QBitArray*,
+                                     OmiHashIndexWriter*);
+  // Also gathers where each entry starts into offsets, if given, for
+  // the strfile(8) index.
+  qint64 writeStrfileToStream(QDataStream&, QList<quint64>* = nullptr);
+  qint64 writeStrfileEntriesToStream(QDataStream&, Section, const char*, bool&,
+                                     qint64, QList<quint64>*);
+  struct EncodedBatch;
+  EncodedBatch encodeOmifileBatch(Section, int, int, const QBitArray*, bool) const;
+  void indexBatch(OmiHashIndexWriter*, Section, const EncodedBatch&,
+                  const QBitArray*);
+  struct StrfileBatch;
+  StrfileBatch encodeStrfileBatch(Section, int, int, const char*) const;
+  qint64 readFromOmifile(QFile&, bool*, bool*);
+  qint64 readOmifileTable(const char*, qint64, const OmiBlocks*,
+                          const TableEntry&, bool, QList<ArenaSpan>&,
+                          QList<TableEntry>&);
   qint64 readFromStrfile(QFile&);
+  qint64 readIndexedStrfile(QFile&, const QList<quint64>&);
+
+  // Read-only, memory-mapped mode.  The tables stay in the mapped
+  // file and entries are only decoded when asked for.
+  QSharedPointer<QFile> mappedFile;
+  const uchar *mappedData;
+  qint64 mappedSize;
+  quint64 commentTable;
+  int commentTableCount;
+  quint64 fortuneTable;
+  int fortuneTableCount;
+  bool mappedWide;
+  // Which file is mapped, to tell a file rewritten in place from one
+  // renamed over it.
+  quint64 mappedDevice;
+  quint64 mappedInode;
+  QCache<TableEntry, QString> decodedCache;
+  QSharedPointer<OmiBlocks> blocks;
+  bool compressed;
+  bool deduplicate;
+  bool indexed;
+  OmiHashIndex hashIndex;
+  QString mappedEntryAt(quint64, int, int);
+  QString decodeMappedEntry(quint64, int, int) const;
+  qint64 mapFile(const QString&);
+  bool mappedTableEntry(quint64, int, int, TableEntry*) const;
+  void materialize();
+  void unmap();
+
+  // Delta saves.  For a document that came from an .omi file, this is
+  // where each entry's payload sits in that file.  An offset of 0
+  // marks an entry that has been added or changed since.
+  struct Origin {
+    QList<TableEntry> spans;
+    TableEntry table;
+    bool reordered;
+    Origin() : table({0, 0}), reordered(false) {}
+  };
+  QString originFile;
+  qint64 originSize;
+  qint64 originIndexSize;
+  // Whether the file has 64-bit offsets, which its delta saves keep.
+  bool originWide;
+  QDateTime originModified;
+  Origin commentOrigin;
+  Origin fortuneOrigin;
+  Origin &originFor(Section section)
+    { return (section == Comments) ? commentOrigin : fortuneOrigin; }
+  void setOrigin(const QString&);
+  void clearOrigin();
+  bool isOriginFile(const QFile&) const;
+  void trackInsert(Section, int, int);
+  void trackRemove(Section, int, int);
+  void trackReplace(Section, int, int);
+  void trackMove(Section, int, int, int);
+  qint64 writeWholeFile(QFile&);
+  qint64 replaceFile(const QString&);
+  qint64 writeDeltaToFile(QFile&);
+  qint64 appendDirtyPayloads(QFile&, Section, qint64&, QList<int>&);
+  qint64 writeDeltaTable(QFile&, Section, const QList<int>&, qint64&, bool&);
+  qint64 writeDeltaIndex(QFile&, qint64);
+  // Takes over the mapping, origin and settings of a document just
+  // read from the same file, whose entries this one now matches.
+  void adoptFile(OmiDoc&, bool);
 
 };
 
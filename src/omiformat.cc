@@ -0,0 +1,193 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "omiformat.hh"
+#include <QtEndian>
+#include <cstring>
+
+bool readOmikujiHeader(OmikujiHeader *header, const char *data, qint64 len) {
+  if (len < omikujiHeaderSize(false)
+      || std::memcmp(data, omikuji_signature, 7) != 0)
+    return false;
+  char version = data[7];
+  if (version < omikuji_version || version > omikuji_wide_compressed_version
+      || len < omikujiHeaderSize(isWideVersion(version)))
+    return false;
+
+  bool wide = isWideVersion(version);
+  header->version = version;
+  copyTableEntry(&header->commentHeader, data, 8, wide);
+  copyTableEntry(&header->fortuneHeader, data, 8 + tableEntrySize(wide), wide);
+  return true;
+}
+
+void fillOmikujiHeader(OmikujiHeader *header, char version,
+                       const TableEntry &comments, const TableEntry &fortunes) {
+  header->version = version;
+  header->commentHeader = comments;
+  header->fortuneHeader = fortunes;
+}
+
+qint64 storeOmikujiHeader(char *out, const OmikujiHeader &header) {
+  bool wide = isWideVersion(header.version);
+  std::memcpy(out, omikuji_signature, 7);
+  out[7] = header.version;
+  storeTableEntry(out + 8, header.commentHeader, wide);
+  storeTableEntry(out + 8 + tableEntrySize(wide), header.fortuneHeader, wide);
+  return omikujiHeaderSize(wide);
+}
+
+TableEntry *copyTableEntry(TableEntry *entry, const char *data, qint64 offset,
+                           bool wide) {
+  if (wide) {
+    entry->offset = qFromBigEndian<quint64>(data + offset);
+    entry->length = qFromBigEndian<quint32>(data + offset + sizeof(quint64));
+  } else {
+    entry->offset = qFromBigEndian<quint32>(data + offset);
+    entry->length = qFromBigEndian<quint32>(data + offset + sizeof(quint32));
+  }
+  return entry;
+}
+
+qint64 storeTableEntry(char *out, const TableEntry &entry, bool wide) {
+  if (wide) {
+    qToBigEndian<quint64>(entry.offset, out);
+    qToBigEndian<quint32>(entry.length, out + sizeof(quint64));
+  } else {
+    qToBigEndian<quint32>(static_cast<quint32>(entry.offset), out);
+    qToBigEndian<quint32>(entry.length, out + sizeof(quint32));
+  }
+  return tableEntrySize(wide);
+}
+
+bool tableEntryAt(const uchar *data, qint64 table, int count, int i,
+                  TableEntry *entry, qint64 payloadStart, qint64 payloadEnd,
+                  bool wide) {
+  if (i < 0 || i >= count)
+    return false;
+
+  copyTableEntry(entry, reinterpret_cast<const char*>(data),
+                 table + i * tableEntrySize(wide), wide);
+  return entry->offset >= static_cast<quint64>(payloadStart)
+    && entry->offset <= static_cast<quint64>(payloadEnd)
+    && static_cast<qint64>(entry->offset) + entry->length <= payloadEnd;
+}
+
+bool readBlockHeader(BlockHeader *header, const char *data, qint64 len,
+                     bool wide) {
+  // The block header of a compressed file follows the file header.
+  qint64 start = omikujiHeaderSize(wide);
+  qint64 end = start + blockHeaderSize(wide);
+  if (len < end)
+    return false;
+  copyTableEntry(&header->blocks, data, start, wide);
+  const char *rest = data + start + tableEntrySize(wide);
+  header->blockSize = qFromBigEndian<quint32>(rest);
+  header->payloadSize = (wide) ? qFromBigEndian<quint64>(rest + sizeof(quint32))
+    : qFromBigEndian<quint32>(rest + sizeof(quint32));
+  return header->blockSize > 0
+    && header->blocks.offset >= static_cast<quint64>(end)
+    && header->blocks.offset <= static_cast<quint64>(len)
+    && static_cast<qint64>(header->blocks.offset)
+       + static_cast<qint64>(header->blocks.length) * tableEntrySize(wide) <= len
+    && static_cast<quint64>(header->blocks.length) * header->blockSize
+       >= header->payloadSize;
+}
+
+void fillBlockHeader(BlockHeader *header, const TableEntry &blocks,
+                     quint32 blockSize, quint64 payloadSize) {
+  header->blocks = blocks;
+  header->blockSize = blockSize;
+  header->payloadSize = payloadSize;
+}
+
+qint64 storeBlockHeader(char *out, const BlockHeader &header, bool wide) {
+  char *rest = out + storeTableEntry(out, header.blocks, wide);
+  qToBigEndian<quint32>(header.blockSize, rest);
+  if (wide)
+    qToBigEndian<quint64>(header.payloadSize, rest + sizeof(quint32));
+  else
+    qToBigEndian<quint32>(static_cast<quint32>(header.payloadSize),
+                          rest + sizeof(quint32));
+  return blockHeaderSize(wide);
+}
+
+static inline quint64 rotateLeft(quint64 x, int bits) {
+  return (x << bits) | (x >> (64 - bits));
+}
+
+quint64 payloadDigest(const char *data, qint64 length) {
+  // Eight bytes at a time, mixed in the way of MurmurHash3, then the
+  // odd bytes at the end and a final avalanche.
+  const quint64 k1 = 0x87c37b91114253d5ULL;
+  const quint64 k2 = 0x4cf5ad432745937fULL;
+  quint64 h = static_cast<quint64>(length) * 0x9e3779b97f4a7c15ULL;
+  qint64 i = 0;
+  for (; i + 8 <= length; i += 8) {
+    quint64 w = qFromLittleEndian<quint64>(data + i);
+    h ^= rotateLeft(w * k1, 31) * k2;
+    h = rotateLeft(h, 27) * 5 + 0x52dce729;
+  }
+  quint64 w = 0;
+  for (int j = 0; i + j < length; j++)
+    w |= static_cast<quint64>(static_cast<uchar>(data[i + j])) << (8 * j);
+  h ^= rotateLeft(w * k1, 31) * k2;
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return (h) ? h : 1;
+}
+
+qint64 utf8Length(QStringView string) {
+  qint64 length = 0;
+  const QChar *p = string.begin();
+  const QChar *end = string.end();
+  for (; p < end; p++) {
+    char16_t u = p->unicode();
+    if (u < 0x80) {
+      length += 1;
+    } else if (u < 0x800) {
+      length += 2;
+    } else if (QChar::isHighSurrogate(u) && p + 1 < end
+               && p[1].isLowSurrogate()) {
+      length += 4;
+      p++;
+    } else if (QChar::isSurrogate(u)) {
+      // Leave unpaired surrogates to QString::toUtf8().
+      return -1;
+    } else {
+      length += 3;
+    }
+  }
+  return length;
+}
+
+void appendUtf8(QByteArray &data, const QString &string,
+                QStringEncoder &encoder) {
+  if (utf8Length(string) < 0) {
+    data.append(string.toUtf8());
+    return;
+  }
+  qsizetype at = data.size();
+  data.resize(at + encoder.requiredSpace(string.size()));
+  char *end = encoder.appendToBuffer(data.data() + at, string);
+  data.resize(end - data.constData());
+}
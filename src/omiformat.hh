@@ -0,0 +1,151 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OMIFORMAT_HH
+#define OMIFORMAT_HH
+
+#include <QtGlobal>
+#include <QHashFunctions>
+#include <QByteArray>
+#include <QString>
+#include <QStringView>
+#include <QStringEncoder>
+
+// The on-disk layout of an omikuji file.  All numbers are stored big
+// endian.  The header points at a table for the comments and another
+// for the fortunes, and each table entry points at one UTF-8 payload.
+//
+// Versions 0 and 1 keep every offset in 32 bits, which stops them at
+// 4 GB.  Versions 2 and 3 are otherwise the same but for 64-bit
+// offsets in the header, the tables, the block header and the hash
+// index; lengths and counts stay 32 bits.  The structs below hold the
+// numbers once they are read, and the functions further down read and
+// write them in either layout.
+
+struct TableEntry {
+  quint64 offset;
+  quint32 length;
+};
+
+inline bool operator==(const TableEntry &a, const TableEntry &b) {
+  return a.offset == b.offset && a.length == b.length;
+}
+
+inline size_t qHash(const TableEntry &entry, size_t seed = 0) {
+  return qHashMulti(seed, entry.offset, entry.length);
+}
+
+struct OmikujiHeader {
+  char version;
+  TableEntry commentHeader;
+  TableEntry fortuneHeader;
+};
+
+const char omikuji_version = 0;
+const char omikuji_compressed_version = 1;
+const char omikuji_wide_version = 2;
+const char omikuji_wide_compressed_version = 3;
+const char omikuji_signature[] = "omikuji";
+
+inline bool isCompressedVersion(char version) { return version & 1; }
+inline bool isWideVersion(char version) { return version & 2; }
+
+// How many bytes each part takes up in a file with 32-bit or 64-bit
+// offsets.
+inline qint64 tableEntrySize(bool wide) { return (wide) ? 12 : 8; }
+inline qint64 omikujiHeaderSize(bool wide) { return (wide) ? 32 : 24; }
+inline qint64 blockHeaderSize(bool wide) { return (wide) ? 24 : 16; }
+const qint64 maxTableEntrySize = 12;
+const qint64 maxOmikujiHeaderSize = 32;
+const qint64 maxBlockHeaderSize = 24;
+// Whether offsets up to end can be written with 32 bits.
+inline bool fitsNarrowOffsets(qint64 end) { return end <= 0xffffffffLL; }
+
+// In a compressed file a BlockHeader comes straight after the header.
+// The payload offsets in the tables then count from the start of all
+// the payloads run together, uncompressed.  That run is cut into
+// blocks of blockSize bytes, each compressed on its own by
+// qCompress(), and blocks points at a table of where each compressed
+// block is in the file and how long it is.
+struct BlockHeader {
+  TableEntry blocks;
+  quint32 blockSize;
+  quint64 payloadSize;
+};
+
+// Any .omi file can end with a hash index of its entries.  The index
+// is two open addressed tables of HashSlots, one per section, each a
+// power of two in size and at most half full.  A slot is found by the
+// digest of an entry's UTF-8 payload and probing goes on to the next
+// slot until one with a digest of 0, which is empty.  The payload
+// field is the entry's own table entry.  A HashIndexTrailer takes up
+// the last bytes of the file and says where the tables are, so
+// readers that do not look for it never see the index at all.  Its
+// version, the very last byte, says whether its offsets are 64 bits.
+struct HashSlot {
+  quint64 digest;
+  TableEntry payload;
+};
+
+struct HashIndexTrailer {
+  TableEntry commentIndex;
+  TableEntry fortuneIndex;
+  char version;
+};
+
+const char omikuji_index_version = 0;
+const char omikuji_wide_index_version = 1;
+const char omikuji_index_signature[] = "omihash";
+
+inline qint64 hashSlotSize(bool wide) { return 8 + tableEntrySize(wide); }
+inline qint64 hashIndexTrailerSize(bool wide)
+  { return 2 * tableEntrySize(wide) + 8; }
+const qint64 maxHashIndexTrailerSize = 32;
+
+// Reads the header at the start of a file of len bytes, and checks
+// its signature and version.
+bool readOmikujiHeader(OmikujiHeader *header, const char *data, qint64 len);
+void fillOmikujiHeader(OmikujiHeader *header, char version,
+                       const TableEntry &comments, const TableEntry &fortunes);
+// These store the big-endian form at out and return its size.
+qint64 storeOmikujiHeader(char *out, const OmikujiHeader &header);
+bool readBlockHeader(BlockHeader *header, const char *data, qint64 len,
+                     bool wide);
+void fillBlockHeader(BlockHeader *header, const TableEntry &blocks,
+                     quint32 blockSize, quint64 payloadSize);
+qint64 storeBlockHeader(char *out, const BlockHeader &header, bool wide);
+TableEntry *copyTableEntry(TableEntry *entry, const char *data, qint64 offset,
+                           bool wide);
+qint64 storeTableEntry(char *out, const TableEntry &entry, bool wide);
+// Reads entry i of the count entries in the table at offset table of
+// a file mapped at data, and checks that its payload lies between
+// payloadStart and payloadEnd.
+bool tableEntryAt(const uchar *data, qint64 table, int count, int i,
+                  TableEntry *entry, qint64 payloadStart, qint64 payloadEnd,
+                  bool wide);
+// The digest of a payload for the hash index.  This is part of the
+// file format, so it must never change.  It is never 0.
+quint64 payloadDigest(const char *data, qint64 length);
+
+// Returns the UTF-8 length of string, or -1 if it holds an unpaired
+// surrogate, in which case only QString::toUtf8() knows for sure.
+qint64 utf8Length(QStringView string);
+void appendUtf8(QByteArray &data, const QString &string,
+                QStringEncoder &encoder);
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "omihashindex.hh"
+#include <QFile>
+#include <QtEndian>
+#include <climits>
+#include <cstring>
+
+bool OmiHashIndex::readTrailer(HashIndexTrailer *trailer, const char *end,
+                               qint64 len) {
+  // The version at the very end says how big the rest of the trailer
+  // is.  The tables have to lie between the file header and the
+  // trailer, and be a power of two in size.
+  trailer->version = end[-1];
+  if (trailer->version != omikuji_index_version
+      && trailer->version != omikuji_wide_index_version)
+    return false;
+  bool wide = trailer->version == omikuji_wide_index_version;
+  qint64 size = hashIndexTrailerSize(wide);
+  if (len < omikujiHeaderSize(false) + size
+      || std::memcmp(end - 8, omikuji_index_signature, 7) != 0)
+    return false;
+  copyTableEntry(&trailer->commentIndex, end - size, 0, wide);
+  copyTableEntry(&trailer->fortuneIndex, end - size, tableEntrySize(wide), wide);
+  TableEntry *tables[2] = { &trailer->commentIndex, &trailer->fortuneIndex };
+  for (TableEntry *table : tables) {
+    if (!table->length)
+      continue;
+    if ((table->length & (table->length - 1)) != 0
+        || table->offset < static_cast<quint64>(omikujiHeaderSize(false))
+        || table->offset > static_cast<quint64>(len)
+        || static_cast<qint64>(table->offset)
+           + static_cast<qint64>(table->length) * hashSlotSize(wide)
+           > len - size)
+      return false;
+  }
+  return true;
+}
+
+bool OmiHashIndex::open(const uchar *data, qint64 len) {
+  this->data = nullptr;
+  HashIndexTrailer trailer;
+  if (len < omikujiHeaderSize(false) + hashIndexTrailerSize(false)
+      || !readTrailer(&trailer, reinterpret_cast<const char*>(data) + len, len))
+    return false;
+  this->data = data;
+  this->len = len;
+  wide = trailer.version == omikuji_wide_index_version;
+  tables[0] = trailer.commentIndex;
+  tables[1] = trailer.fortuneIndex;
+  return true;
+}
+
+QList<TableEntry> OmiHashIndex::find(int table, quint64 digest) const {
+  QList<TableEntry> found;
+  if (!data || table < 0 || table > 1 || !tables[table].length)
+    return found;
+
+  quint32 mask = tables[table].length - 1;
+  const uchar *slots = data + tables[table].offset;
+  qint64 slotSize = hashSlotSize(wide);
+  quint32 at = static_cast<quint32>(digest) & mask;
+  for (quint32 probes = 0; probes <= mask; probes++) {
+    const uchar *slot = slots + at * slotSize;
+    quint64 slotDigest = qFromBigEndian<quint64>(slot);
+    if (!slotDigest)
+      break;
+    if (slotDigest == digest) {
+      TableEntry entry;
+      copyTableEntry(&entry, reinterpret_cast<const char*>(slot),
+                     sizeof(quint64), wide);
+      found.append(entry);
+    }
+    at = (at + 1) & mask;
+  }
+  return found;
+}
+
+qint64 OmiHashIndex::sizeInFile(const QString &filename) {
+  QFile file(filename);
+  qint64 len = file.size();
+  char bytes[maxHashIndexTrailerSize];
+  qint64 size = qMin<qint64>(len, sizeof(bytes));
+  if (len < omikujiHeaderSize(false) + hashIndexTrailerSize(false)
+      || !file.open(QIODevice::ReadOnly)
+      || !file.seek(len - size))
+    return 0;
+  HashIndexTrailer trailer;
+  if (file.read(bytes, size) != size
+      || !readTrailer(&trailer, bytes + size, len))
+    return 0;
+  bool wide = trailer.version == omikuji_wide_index_version;
+  return hashIndexTrailerSize(wide)
+    + (static_cast<qint64>(trailer.commentIndex.length)
+       + trailer.fortuneIndex.length) * hashSlotSize(wide);
+}
+
+void OmiHashIndexWriter::add(int table, quint64 digest,
+                             const TableEntry &payload) {
+  entries[table].append({ digest, payload });
+}
+
+qint64 OmiHashIndexWriter::write(QDataStream &stream, qint64 offset,
+                                 bool wide) const {
+  // Twice as many slots as entries keeps the probes short.
+  quint32 sizes[2] = { 0, 0 };
+  qint64 slotSize = hashSlotSize(wide);
+  qint64 size = hashIndexTrailerSize(wide);
+  for (int t = 0; t < 2; t++) {
+    if (entries[t].isEmpty())
+      continue;
+    quint64 slots = 2;
+    while (slots < 2 * static_cast<quint64>(entries[t].count()))
+      slots *= 2;
+    if (slots > UINT_MAX / static_cast<quint64>(slotSize))
+      return 0;
+    sizes[t] = static_cast<quint32>(slots);
+    size += slots * slotSize;
+  }
+  if (!wide && !fitsNarrowOffsets(offset + size))
+    return 0;
+
+  qint64 bytesOut = 0;
+  HashIndexTrailer trailer;
+  TableEntry *tables[2] = { &trailer.commentIndex, &trailer.fortuneIndex };
+  for (int t = 0; t < 2; t++) {
+    *tables[t] = { 0, 0 };
+    if (!sizes[t])
+      continue;
+    QList<HashSlot> slots(sizes[t], HashSlot({ 0, { 0, 0 } }));
+    quint32 mask = sizes[t] - 1;
+    for (const HashSlot &entry : entries[t]) {
+      quint32 at = static_cast<quint32>(entry.digest) & mask;
+      while (slots.at(at).digest)
+        at = (at + 1) & mask;
+      slots[at] = entry;
+    }
+    *tables[t] = { static_cast<quint64>(offset + bytesOut), sizes[t] };
+    // Stored a few thousand slots at a time.
+    QByteArray bytes;
+    bytes.reserve(4096 * slotSize);
+    for (const HashSlot &slot : slots) {
+      char stored[8 + maxTableEntrySize];
+      qToBigEndian<quint64>(slot.digest, stored);
+      storeTableEntry(stored + 8, slot.payload, wide);
+      bytes.append(stored, slotSize);
+      if (bytes.size() >= 4096 * slotSize) {
+        bytesOut += stream.writeRawData(bytes.constData(), bytes.size());
+        bytes.resize(0);
+      }
+    }
+    bytesOut += stream.writeRawData(bytes.constData(), bytes.size());
+  }
+  char stored[maxHashIndexTrailerSize];
+  char *at = stored + storeTableEntry(stored, trailer.commentIndex, wide);
+  at += storeTableEntry(at, trailer.fortuneIndex, wide);
+  std::memcpy(at, omikuji_index_signature, 7);
+  at[7] = (wide) ? omikuji_wide_index_version : omikuji_index_version;
+  bytesOut += stream.writeRawData(stored, hashIndexTrailerSize(wide));
+  return bytesOut;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OMIHASHINDEX_HH
+#define OMIHASHINDEX_HH
+
+#include <QList>
+#include <QString>
+#include <QDataStream>
+#include "omiformat.hh"
+
+// Reads the hash index at the end of an .omi file mapped at data,
+// which has to outlive it.  Tables are numbered as OmiDoc's sections.
+class OmiHashIndex
+{
+public:
+  OmiHashIndex()
+    : data(nullptr), len(0), wide(false), tables{ { 0, 0 }, { 0, 0 } } {}
+  // False if the file does not end with a sound index.
+  bool open(const uchar *data, qint64 len);
+  bool isValid() const { return data != nullptr; }
+  // The table entries in a table with this digest.  A lookup reads
+  // the slots from where the digest lands up to the next empty one,
+  // which is nearly always on the same page.
+  QList<TableEntry> find(int table, quint64 digest) const;
+  // How many bytes the index at the end of filename takes up, or 0 if
+  // it has none.
+  static qint64 sizeInFile(const QString &filename);
+
+private:
+  const uchar *data;
+  qint64 len;
+  bool wide;
+  TableEntry tables[2];
+  static bool readTrailer(HashIndexTrailer*, const char*, qint64);
+};
+
+// Gathers the digests of entries as they are written, then writes the
+// index out after them.
+class OmiHashIndexWriter
+{
+public:
+  void add(int table, quint64 digest, const TableEntry &payload);
+  // Writes the index to stream, which is offset bytes into the file,
+  // with 64-bit offsets if wide.  Returns the bytes written, or 0 if
+  // a narrow index would not fit below 4 GB, in which case the file
+  // simply goes without.
+  qint64 write(QDataStream &stream, qint64 offset, bool wide) const;
+
+private:
+  QList<HashSlot> entries[2];
+};
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "omilistmodel.hh"
+
+OmiListModel::OmiListModel(OmiDoc *doc, OmiDoc::Section section, QObject *parent)
+  : QAbstractListModel(parent), doc(doc), docSection(section)
+{
+  connect(doc, &OmiDoc::entriesAboutToChange, this, &OmiListModel::entriesAboutToChange);
+  connect(doc, &OmiDoc::entriesChanged, this, &OmiListModel::entriesChanged);
+  connect(doc, &OmiDoc::entriesAboutToMove, this, &OmiListModel::entriesAboutToMove);
+  connect(doc, &OmiDoc::entriesMoved, this, &OmiListModel::entriesMoved);
+  connect(doc, &OmiDoc::aboutToReset, this, &OmiListModel::beginResetModel);
+  connect(doc, &OmiDoc::reset, this, &OmiListModel::endResetModel);
+}
+
+int OmiListModel::rowCount(const QModelIndex &parent) const {
+  if (parent.isValid())
+    return 0;
+  return (docSection == OmiDoc::Comments) ? doc->commentCount() : doc->fortuneCount();
+}
+
+QVariant OmiListModel::data(const QModelIndex &index, int role) const {
+  if (!index.isValid())
+    return QVariant();
+
+  if (role == Qt::DisplayRole || role == Qt::ToolTipRole || role == Qt::EditRole) {
+    QString text = (docSection == OmiDoc::Comments)
+      ? doc->commentAt(index.row()) : doc->fortuneAt(index.row());
+    // Rows are all one line high, so the list shows each entry on a
+    // single line; the tooltip has the whole thing.
+    if (role == Qt::DisplayRole)
+      return text.simplified();
+    return text;
+  }
+
+  return QVariant();
+}
+
+void OmiListModel::entriesAboutToChange(OmiDoc::Section section, int index,
+                                        int removed, int inserted) {
+  if (section != docSection || removed == inserted)
+    return;
+  if (removed == 0)
+    beginInsertRows(QModelIndex(), index, index + inserted - 1);
+  else if (inserted == 0)
+    beginRemoveRows(QModelIndex(), index, index + removed - 1);
+  else
+    beginResetModel();
+}
+
+void OmiListModel::entriesChanged(OmiDoc::Section section, int index,
+                                  int removed, int inserted) {
+  if (section != docSection)
+    return;
+  if (removed == inserted) {
+    if (removed > 0)
+      emit dataChanged(this->index(index), this->index(index + removed - 1));
+  } else if (removed == 0) {
+    endInsertRows();
+  } else if (inserted == 0) {
+    endRemoveRows();
+  } else {
+    endResetModel();
+  }
+}
+
+void OmiListModel::entriesAboutToMove(OmiDoc::Section section, int index,
+                                      int count, int destination) {
+  if (section == docSection)
+    beginMoveRows(QModelIndex(), index, index + count - 1, QModelIndex(),
+                  destination);
+}
+
+void OmiListModel::entriesMoved(OmiDoc::Section section, int, int, int) {
+  if (section == docSection)
+    endMoveRows();
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OMILISTMODEL_HH
+#define OMILISTMODEL_HH
+
+#include <QAbstractListModel>
+#include "omidoc.hh"
+
+// Presents one section of an OmiDoc to a view.  Nothing is copied out
+// of the document; entries are fetched as the view asks for them.
+class OmiListModel : public QAbstractListModel
+{
+  Q_OBJECT
+
+public:
+  OmiListModel(OmiDoc *doc, OmiDoc::Section section, QObject *parent = nullptr);
+
+  int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+  QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+  OmiDoc::Section section() const { return docSection; }
+
+private slots:
+  void entriesAboutToChange(OmiDoc::Section, int, int, int);
+  void entriesChanged(OmiDoc::Section, int, int, int);
+  void entriesAboutToMove(OmiDoc::Section, int, int, int);
+  void entriesMoved(OmiDoc::Section, int, int, int);
+
+private:
+  OmiDoc *doc;
+  OmiDoc::Section docSection;
+};
+
+#endif
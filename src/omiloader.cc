@@ -0,0 +1,103 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "omiloader.hh"
+#include "strfilereader.hh"
+#include "strfileindex.hh"
+#include <QFile>
+#include <QtConcurrent>
+
+// The first batch is small so that something shows up at once.
+const int firstBatchSize = 256;
+const int batchSize = 16384;
+
+OmiLoader::OmiLoader(const QString &filename, QObject *parent)
+  : QObject(parent), filename(filename), cancelled(false)
+{
+}
+
+OmiLoader::~OmiLoader()
+{
+  cancel();
+  future.waitForFinished();
+}
+
+void OmiLoader::start()
+{
+  future = QtConcurrent::run([this]() { run(); });
+}
+
+void OmiLoader::cancel()
+{
+  cancelled = true;
+}
+
+void OmiLoader::run()
+{
+  QFile file(filename);
+  if (!file.open(QIODevice::ReadOnly)) {
+    emit finished(false);
+    return;
+  }
+
+  qint64 total = file.size();
+  qint64 position = 0;
+  int wanted = firstBatchSize;
+  QByteArrayList batch;
+  StrfileReader::Sink sink = [&](const char *data, qsizetype length) {
+    if (cancelled)
+      return false;
+    // Left as UTF-8 for the document to take as it is.
+    batch.append(QByteArray(data, length));
+    if (batch.count() >= wanted) {
+      // Hand over the list itself rather than a copy of it.
+      QByteArrayList ready;
+      ready.swap(batch);
+      emit entriesRead(ready);
+      emit progress((position) ? position : file.pos(), total);
+      wanted = batchSize;
+    }
+    return true;
+  };
+
+  // With an index from strfile(8) that still goes with the file, the
+  // entries are cut out of the mapping where it says, with no scan.
+  QList<quint64> offsets;
+  uchar *mapped = nullptr;
+  if (total && readStrfileIndex(filename, &offsets))
+    mapped = file.map(0, total);
+  qint64 bytesRead;
+  if (mapped) {
+    const char *data = reinterpret_cast<const char*>(mapped);
+    for (int i = 0; i + 1 < offsets.count(); i++) {
+      position = offsets.at(i + 1);
+      if (!StrfileReader::readEntry(data + offsets.at(i),
+                                    offsets.at(i + 1) - offsets.at(i), sink))
+        break;
+    }
+    file.unmap(mapped);
+    bytesRead = total;
+  } else {
+    StrfileReader reader(&file);
+    bytesRead = reader.read(sink);
+  }
+
+  if (!batch.isEmpty() && !cancelled)
+    emit entriesRead(batch);
+  emit finished(bytesRead > 0 && !cancelled);
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OMILOADER_HH
+#define OMILOADER_HH
+
+#include <QObject>
+#include <QString>
+#include <QByteArrayList>
+#include <QFuture>
+#include <atomic>
+
+// Reads a strfile on a worker thread and passes the entries back in
+// batches as it goes, so a window can show them before the whole file
+// has been read.  The signals arrive queued in the receiver's thread.
+class OmiLoader : public QObject
+{
+  Q_OBJECT
+
+public:
+  explicit OmiLoader(const QString &filename, QObject *parent = nullptr);
+  ~OmiLoader();
+  void start();
+
+public slots:
+  void cancel();
+
+signals:
+  void entriesRead(const QByteArrayList &entries);
+  void progress(qint64 bytesRead, qint64 bytesTotal);
+  void finished(bool success);
+
+private:
+  QString filename;
+  std::atomic<bool> cancelled;
+  QFuture<void> future;
+  void run();
+};
+
+#endif
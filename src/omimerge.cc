@@ -0,0 +1,578 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "omimerge.hh"
+#include "omidoc.hh"
+#include "omiformat.hh"
+#include "omiwriter.hh"
+#include "strfileindex.hh"
+#include "utf8arena.hh"
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QMultiHash>
+#include <QQueue>
+#include <QScopedPointer>
+#include <QSharedPointer>
+#include <QTemporaryFile>
+#include <QtConcurrent>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+
+// The memory limit when none is set.
+const qint64 defaultMemoryLimit = 512 * 1024 * 1024;
+// Runs are never cut smaller than this, however many threads share the
+// limit, as each one holds at least an arena chunk.
+const qint64 minRunSize = 4 * 1024 * 1024;
+// At most this many runs are merged at once; past it, runs are merged
+// into fewer, longer ones first.
+const int maxMergeWidth = 128;
+// Spilled runs are written and read this much at a time, at most.
+const qsizetype maxRunBufferSize = 1024 * 1024;
+const qsizetype minRunBufferSize = 4 * 1024;
+
+// A strfile is read into memory; an .omi file is mapped.
+static QSharedPointer<OmiDoc> openInput(const QString &filename)
+{
+  QSharedPointer<OmiDoc> doc(new OmiDoc);
+  qint64 bytesRead;
+  if (filename.endsWith(".omi")) {
+    bytesRead = doc->mapFromFile(filename);
+  } else {
+    QFile file(filename);
+    bytesRead = doc->readFromFile(file);
+  }
+  if (bytesRead < 0)
+    doc.reset();
+  return doc;
+}
+
+static bool lessBytes(QByteArrayView a, QByteArrayView b)
+{
+  qsizetype common = qMin(a.size(), b.size());
+  int order = (common) ? std::memcmp(a.data(), b.data(), common) : 0;
+  return (order) ? order < 0 : a.size() < b.size();
+}
+
+static bool sameBytes(QByteArrayView a, QByteArrayView b)
+{
+  return a.size() == b.size()
+    && (a.isEmpty() || std::memcmp(a.data(), b.data(), a.size()) == 0);
+}
+
+// Where merged entries go: an OmiWriter, or a strfile laid out as
+// OmiDoc writes one, which has no room for empty entries.  Unless the
+// entries are sorted, repeats are found by the digests of what has
+// been written, checked against the bytes read back from the output.
+class OmiMerger::Output
+{
+public:
+  Output(QFile *file, bool checkRepeats, bool indexed)
+    : file(file), checkRepeats(checkRepeats), wantSeparator(false),
+      count(0)
+  {
+    if (file->fileName().endsWith(".omi")) {
+      omi.reset(new OmiWriter(file));
+      omi->setIndexed(indexed);
+    }
+  }
+
+  bool add(OmiDoc::Section section, QByteArrayView bytes)
+  {
+    if (!omi && bytes.isEmpty())
+      return true;
+    TableEntry span = { static_cast<quint64>(file->pos()),
+                        static_cast<quint32>(bytes.size()) };
+    quint64 digest = 0;
+    if (checkRepeats) {
+      digest = payloadDigest(bytes.data(), bytes.size());
+      bool repeat;
+      if (!isRepeat(section, digest, bytes, repeat))
+        return false;
+      if (repeat)
+        return true;
+    }
+
+    if (omi) {
+      if (!omi->append(section, bytes))
+        return false;
+    } else {
+      if (wantSeparator) {
+        if (file->write("%\n", 2) != 2)
+          return false;
+        span.offset += 2;
+      }
+      if (file->write(bytes.data(), bytes.size()) != bytes.size()
+          || (bytes.back() != '\n' && !file->putChar('\n')))
+        return false;
+      wantSeparator = true;
+      offsets.append(span.offset);
+    }
+    if (checkRepeats)
+      written[section].insert(digest, span);
+    count++;
+    return true;
+  }
+
+  bool finish()
+  {
+    if (omi)
+      return omi->finish() >= 0;
+    offsets.append(file->pos());
+    return file->flush();
+  }
+
+  qint64 entries() const { return count; }
+  // Where each entry of a strfile output starts, and where it ends.
+  const QList<quint64> &strfileOffsets() const { return offsets; }
+
+private:
+  bool isRepeat(OmiDoc::Section section, quint64 digest, QByteArrayView bytes,
+                bool &repeat)
+  {
+    repeat = false;
+    auto it = written[section].constFind(digest);
+    if (it == written[section].constEnd())
+      return true;
+    qint64 end = file->pos();
+    QByteArray earlier;
+    for (; it != written[section].constEnd() && it.key() == digest; ++it) {
+      if (it->length != bytes.size())
+        continue;
+      if (!file->seek(it->offset))
+        return false;
+      earlier = file->read(it->length);
+      if (sameBytes(earlier, bytes)) {
+        repeat = true;
+        break;
+      }
+    }
+    return file->seek(end);
+  }
+
+  QFile *file;
+  QScopedPointer<OmiWriter> omi;
+  bool checkRepeats;
+  bool wantSeparator;
+  qint64 count;
+  QMultiHash<quint64, TableEntry> written[2];
+  QList<quint64> offsets;
+};
+
+OmiMerger::OmiMerger()
+  : sorted(false), deduplicate(false), indexed(false),
+    memoryLimit(defaultMemoryLimit)
+{
+}
+
+qint64 OmiMerger::merge(const QStringList &inputs, const QString &output)
+{
+  error.clear();
+  // Truncating an input would pull it out from under its mapping.
+  QFileInfo target(output);
+  for (const QString &input : inputs) {
+    if (target.exists() && QFileInfo(input).canonicalFilePath()
+        == target.canonicalFilePath()) {
+      error = QString("cannot merge %1 into itself").arg(input);
+      return -1;
+    }
+  }
+
+  // The output is read back from to spot repeats, and an .omi output
+  // goes back to its start for the header.
+  QFile file(output);
+  if (!file.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+    error = QString("cannot write %1").arg(output);
+    return -1;
+  }
+  Output out(&file, deduplicate && !sorted, indexed);
+  bool ok = (sorted) ? mergeSorted(inputs, out) : concatenate(inputs, out);
+  if (ok && !out.finish()) {
+    error = QString("cannot write %1").arg(output);
+    ok = false;
+  }
+  file.close();
+  if (ok && !output.endsWith(".omi"))
+    writeStrfileIndex(output, out.strfileOffsets());
+  return (ok) ? out.entries() : -1;
+}
+
+bool OmiMerger::concatenate(const QStringList &inputs, Output &out)
+{
+  int window = qMax(1, QThreadPool::globalInstance()->maxThreadCount());
+  QByteArray buffer;
+  for (OmiDoc::Section section : { OmiDoc::Comments, OmiDoc::Fortunes }) {
+    // Strfiles have no comments, so the first pass only opens the .omi
+    // files, and each input is let go of as soon as it is copied.
+    QQueue<QPair<QString, QFuture<QSharedPointer<OmiDoc>>>> pending;
+    int next = 0;
+    while (next < inputs.count() || !pending.isEmpty()) {
+      while (next < inputs.count() && pending.count() < window) {
+        const QString &input = inputs.at(next++);
+        if (section == OmiDoc::Comments && !input.endsWith(".omi"))
+          continue;
+        pending.enqueue({ input, QtConcurrent::run(openInput, input) });
+      }
+      if (pending.isEmpty())
+        break;
+
+      QString input = pending.head().first;
+      QSharedPointer<OmiDoc> doc = pending.dequeue().second.result();
+      if (!doc) {
+        error = QString("cannot read %1").arg(input);
+        return false;
+      }
+      OmiDoc::Snapshot entries = doc->snapshot(section);
+      for (int i = 0; i < entries.count(); i++) {
+        if (!out.add(section, entries.utf8At(i, buffer))) {
+          error = QString("cannot write the output");
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// A sorted run of one section's entries, either held in an arena or
+// spilled to a temporary file as a native quint32 length and then the
+// bytes of each entry.  Spilled runs are only open while they are being
+// written or read, as a big sort can make more of them than a process
+// may have files open.
+struct SortRun
+{
+  Utf8Arena arena;
+  QList<ArenaSpan> entries;
+  QSharedPointer<QTemporaryFile> file;
+
+  qint64 bytesHeld() const
+    { return arena.size() + entries.count() * qint64(sizeof(ArenaSpan)); }
+};
+
+typedef QSharedPointer<SortRun> SortRunPointer;
+
+// Writes entries to a new spilled run.
+class RunWriter
+{
+public:
+  RunWriter() : file(new QTemporaryFile(QDir::tempPath() + "/omiquji-merge"))
+  {
+    failed = !file->open();
+  }
+
+  bool add(QByteArrayView bytes)
+  {
+    quint32 length = bytes.size();
+    buffer.append(reinterpret_cast<const char *>(&length), sizeof(length));
+    buffer.append(bytes);
+    return buffer.size() < maxRunBufferSize || flush();
+  }
+
+  // Closes the file and hands it over.
+  QSharedPointer<QTemporaryFile> finish()
+  {
+    bool ok = flush();
+    file->close();
+    return (ok) ? file : QSharedPointer<QTemporaryFile>();
+  }
+
+private:
+  bool flush()
+  {
+    if (!failed)
+      failed = file->write(buffer) != buffer.size();
+    buffer.resize(0);
+    return !failed;
+  }
+
+  QSharedPointer<QTemporaryFile> file;
+  QByteArray buffer;
+  bool failed;
+};
+
+// Goes through the entries of a run in order.  The current entry
+// stays where it is until the next one is asked for.
+class RunReader
+{
+public:
+  RunReader(const SortRun *run, qsizetype bufferSize)
+    : run(run), bufferSize(bufferSize), at(-1), used(0), broken(false) {}
+
+  bool next()
+  {
+    if (!run->file) {
+      if (++at >= run->entries.count())
+        return false;
+      entry = run->arena.view(run->entries.at(at));
+      return true;
+    }
+
+    quint32 length;
+    if (!fill(sizeof(length))) {
+      run->file->close();
+      return false;
+    }
+    std::memcpy(&length, buffer.constData() + used, sizeof(length));
+    used += sizeof(length);
+    if (!fill(length)) {
+      broken = true;
+      return false;
+    }
+    entry = QByteArrayView(buffer.constData() + used, length);
+    used += length;
+    return true;
+  }
+
+  QByteArrayView current() const { return entry; }
+  bool failed() const { return broken; }
+
+private:
+  // Makes sure the next needed bytes are in the buffer.
+  bool fill(qsizetype needed)
+  {
+    if (buffer.size() - used >= needed)
+      return true;
+    if (!run->file->isOpen() && !run->file->open()) {
+      broken = true;
+      return false;
+    }
+    buffer.remove(0, used);
+    used = 0;
+    qsizetype have = buffer.size();
+    qsizetype want = qMax(needed - have, bufferSize);
+    buffer.resize(have + want);
+    qint64 got = run->file->read(buffer.data() + have, want);
+    if (got < 0)
+      broken = true;
+    buffer.resize(have + qMax(got, qint64(0)));
+    return buffer.size() >= needed;
+  }
+
+  const SortRun *run;
+  qsizetype bufferSize;
+  int at;
+  QByteArray buffer;
+  qsizetype used;
+  QByteArrayView entry;
+  bool broken;
+};
+
+static void sortRun(SortRun *run, bool deduplicate)
+{
+  const Utf8Arena &arena = run->arena;
+  std::sort(run->entries.begin(), run->entries.end(),
+    [&arena](const ArenaSpan &a, const ArenaSpan &b) {
+      return lessBytes(arena.view(a), arena.view(b));
+    });
+  if (deduplicate) {
+    auto end = std::unique(run->entries.begin(), run->entries.end(),
+      [&arena](const ArenaSpan &a, const ArenaSpan &b) {
+        return sameBytes(arena.view(a), arena.view(b));
+      });
+    run->entries.erase(end, run->entries.end());
+  }
+}
+
+static bool spillRun(SortRun *run)
+{
+  RunWriter writer;
+  for (const ArenaSpan &span : std::as_const(run->entries))
+    if (!writer.add(run->arena.view(span)))
+      return false;
+  run->file = writer.finish();
+  run->arena.clear();
+  run->entries.clear();
+  return !run->file.isNull();
+}
+
+// Merges runs in order, handing each entry to emit.  With deduplicate,
+// an entry the same as the one before it is passed over.
+static bool mergeRuns(const QList<SortRunPointer> &runs, qint64 memory,
+                      bool deduplicate,
+                      const std::function<bool(QByteArrayView)> &emit)
+{
+  int spilled = 0;
+  for (const SortRunPointer &run : runs)
+    if (run->file)
+      spilled++;
+  qsizetype bufferSize = qBound<qint64>(minRunBufferSize,
+                                        memory / qMax(spilled, 1),
+                                        maxRunBufferSize);
+
+  QList<QSharedPointer<RunReader>> readers;
+  QList<int> heap;
+  for (const SortRunPointer &run : runs) {
+    QSharedPointer<RunReader> reader(new RunReader(run.data(), bufferSize));
+    if (reader->next())
+      heap.append(readers.count());
+    else if (reader->failed())
+      return false;
+    readers.append(reader);
+  }
+
+  // A heap puts its greatest first, so this is the wrong way round.
+  // Equal entries come out in run order.
+  auto after = [&readers](int a, int b) {
+    QByteArrayView x = readers.at(a)->current(), y = readers.at(b)->current();
+    if (lessBytes(y, x))
+      return true;
+    return !lessBytes(x, y) && b < a;
+  };
+  std::make_heap(heap.begin(), heap.end(), after);
+
+  QByteArray last;
+  bool haveLast = false;
+  while (!heap.isEmpty()) {
+    std::pop_heap(heap.begin(), heap.end(), after);
+    int r = heap.takeLast();
+    QByteArrayView bytes = readers.at(r)->current();
+    if (!deduplicate || !haveLast || !sameBytes(last, bytes)) {
+      if (!emit(bytes))
+        return false;
+      if (deduplicate) {
+        last.resize(0);
+        last.append(bytes);
+        haveLast = true;
+      }
+    }
+    if (readers.at(r)->next()) {
+      heap.append(r);
+      std::push_heap(heap.begin(), heap.end(), after);
+    } else if (readers.at(r)->failed()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The runs made from one input, for each section.
+struct InputRuns
+{
+  bool ok = true;
+  QList<SortRunPointer> runs[2];
+};
+
+// Cuts an input into sorted runs of about runSize bytes, spilling all
+// but the last of each section.  The last stays in memory if it fits
+// in what is left of holdLimit.
+static InputRuns sortInput(const QString &input, qint64 runSize,
+                           bool deduplicate, std::atomic<qint64> *held,
+                           qint64 holdLimit)
+{
+  InputRuns result;
+  QSharedPointer<OmiDoc> doc = openInput(input);
+  if (!doc) {
+    result.ok = false;
+    return result;
+  }
+
+  QByteArray buffer;
+  for (OmiDoc::Section section : { OmiDoc::Comments, OmiDoc::Fortunes }) {
+    OmiDoc::Snapshot entries = doc->snapshot(section);
+    SortRunPointer run(new SortRun);
+    for (int i = 0; i < entries.count(); i++) {
+      QByteArrayView bytes = entries.utf8At(i, buffer);
+      run->entries.append(run->arena.add(bytes.data(), bytes.size()));
+      if (run->bytesHeld() >= runSize) {
+        sortRun(run.data(), deduplicate);
+        if (!spillRun(run.data())) {
+          result.ok = false;
+          return result;
+        }
+        result.runs[section].append(run);
+        run.reset(new SortRun);
+      }
+    }
+    if (run->entries.isEmpty())
+      continue;
+
+    sortRun(run.data(), deduplicate);
+    qint64 size = run->bytesHeld();
+    if (held->fetch_add(size) + size > holdLimit) {
+      held->fetch_sub(size);
+      if (!spillRun(run.data())) {
+        result.ok = false;
+        return result;
+      }
+    }
+    result.runs[section].append(run);
+  }
+  return result;
+}
+
+bool OmiMerger::mergeSorted(const QStringList &inputs, Output &out)
+{
+  // Half the limit is for the runs being cut, shared between the
+  // threads, and half for the runs kept in memory until the merge.
+  int threads = qMax(1, QThreadPool::globalInstance()->maxThreadCount());
+  qint64 runSize = qMax(minRunSize, memoryLimit / 2 / threads);
+  std::atomic<qint64> held(0);
+  qint64 holdLimit = memoryLimit / 2;
+  bool dedup = deduplicate;
+  QList<InputRuns> made = QtConcurrent::blockingMapped<QList<InputRuns>>(
+    inputs, [runSize, dedup, holdLimit, &held](const QString &input) {
+      return sortInput(input, runSize, dedup, &held, holdLimit);
+    });
+
+  for (int i = 0; i < made.count(); i++) {
+    if (!made.at(i).ok) {
+      error = QString("cannot read or sort %1").arg(inputs.at(i));
+      return false;
+    }
+  }
+
+  for (OmiDoc::Section section : { OmiDoc::Comments, OmiDoc::Fortunes }) {
+    QList<SortRunPointer> runs;
+    for (InputRuns &input : made) {
+      runs.append(input.runs[section]);
+      input.runs[section].clear();
+    }
+
+    // Too many spilled runs at once would each get too small a buffer,
+    // so they are merged a group at a time into longer ones first.
+    while (runs.count() > maxMergeWidth) {
+      QList<SortRunPointer> group = runs.mid(0, maxMergeWidth);
+      runs.remove(0, maxMergeWidth);
+      RunWriter writer;
+      SortRunPointer merged(new SortRun);
+      if (!mergeRuns(group, memoryLimit / 2, dedup,
+                     [&writer](QByteArrayView bytes) {
+                       return writer.add(bytes);
+                     })
+          || (merged->file = writer.finish()).isNull()) {
+        error = QString("cannot write a temporary file");
+        return false;
+      }
+      runs.append(merged);
+    }
+
+    bool wrote = true;
+    if (!mergeRuns(runs, memoryLimit / 2, dedup,
+                   [&out, &wrote, section](QByteArrayView bytes) {
+                     wrote = out.add(section, bytes);
+                     return wrote;
+                   })) {
+      error = (wrote) ? QString("cannot read a temporary file")
+        : QString("cannot write the output");
+      return false;
+    }
+  }
+  return true;
+}
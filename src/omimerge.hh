@@ -0,0 +1,62 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OMIMERGE_HH
+#define OMIMERGE_HH
+
+#include <QString>
+#include <QStringList>
+
+// Merges strfiles and .omi files into one, for --merge.  Inputs are
+// opened through OmiDoc on the thread pool, a few ahead of the one
+// being copied, and the output is written as it is made, as an .omi
+// file or a strfile by its name.  Comments come first and fortunes
+// after, each section holding the entries of every input in turn.
+//
+// Entries can be sorted by their UTF-8 bytes and repeats within a
+// section dropped.  A sort never holds much more than the memory limit:
+// each input is cut into sorted runs on the pool, runs that do not fit
+// are spilled to temporary files, and the runs are merged as the output
+// is written.
+class OmiMerger
+{
+public:
+  OmiMerger();
+  void setSorted(bool on) { sorted = on; }
+  void setDeduplicated(bool on) { deduplicate = on; }
+  // Whether an .omi output ends with a hash index.
+  void setIndexed(bool on) { indexed = on; }
+  void setMemoryLimit(qint64 bytes) { memoryLimit = bytes; }
+  // Returns the number of entries written, or -1 if an input could not
+  // be read or the output written.
+  qint64 merge(const QStringList &inputs, const QString &output);
+  QString errorString() const { return error; }
+
+private:
+  class Output;
+  bool concatenate(const QStringList &inputs, Output &out);
+  bool mergeSorted(const QStringList &inputs, Output &out);
+
+  bool sorted;
+  bool deduplicate;
+  bool indexed;
+  qint64 memoryLimit;
+  QString error;
+};
+
+#endif
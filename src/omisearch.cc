@@ -0,0 +1,136 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "omisearch.hh"
+#include <QThreadPool>
+#include <QtConcurrent>
+
+// Workers take entries this many at a time, and send their matches
+// back after each chunk.
+const int searchChunkSize = 2048;
+// How much of an entry to show either side of a match.
+const int excerptBefore = 24;
+const int excerptAfter = 48;
+
+static QString excerptOf(const QString &entry, qsizetype position,
+                         qsizetype length)
+{
+  qsizetype first = qMax<qsizetype>(0, position - excerptBefore);
+  qsizetype last = qMin<qsizetype>(entry.size(), position + length + excerptAfter);
+  QString excerpt = entry.mid(first, last - first).simplified();
+  if (first > 0)
+    excerpt.prepend(QStringLiteral("..."));
+  if (last < entry.size())
+    excerpt.append(QStringLiteral("..."));
+  return excerpt;
+}
+
+OmiSearch::OmiSearch(const OmiDoc::Snapshot &entries,
+                     const QRegularExpression &pattern, int timeLimit,
+                     QObject *parent)
+  : QObject(parent), entries(entries), pattern(pattern),
+    timeLimit(timeLimit), maxMatches(100000), status(Running),
+    nextChunk(0), searched(0), matchCount(0), running(0)
+{
+}
+
+OmiSearch::~OmiSearch()
+{
+  Q_ASSERT(!running);
+}
+
+void OmiSearch::start()
+{
+  // Compile the pattern once, up front, rather than in every worker.
+  pattern.optimize();
+  deadline = (timeLimit > 0) ? QDeadlineTimer(timeLimit)
+    : QDeadlineTimer(QDeadlineTimer::Forever);
+
+  int chunks = (entries.count() + searchChunkSize - 1) / searchChunkSize;
+  int threads = qMax(1, qMin(QThreadPool::globalInstance()->maxThreadCount(),
+                             chunks));
+  running = threads;
+  for (int i = 0; i < threads; i++) {
+    QFutureWatcher<void> *watcher = new QFutureWatcher<void>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, &OmiSearch::workerFinished);
+    watcher->setFuture(QtConcurrent::run([this]() { run(); }));
+  }
+}
+
+void OmiSearch::cancel()
+{
+  stopWith(Cancelled);
+}
+
+void OmiSearch::workerFinished()
+{
+  // The last worker out reports how it went.
+  if (--running == 0) {
+    stopWith(Finished);
+    emit finished(static_cast<Status>(status.load()));
+  }
+}
+
+void OmiSearch::stopWith(Status reason)
+{
+  // Only the first reason to stop sticks.
+  int expected = Running;
+  status.compare_exchange_strong(expected, reason);
+}
+
+void OmiSearch::run()
+{
+  int total = entries.count();
+  QList<Match> found;
+
+  while (status == Running) {
+    int first = nextChunk.fetch_add(1) * searchChunkSize;
+    if (first >= total)
+      break;
+    int last = qMin(first + searchChunkSize, total);
+
+    int row = first;
+    for (; row < last; row++) {
+      // A pattern that backtracks badly can still hold up a single
+      // entry, but not the window, and not past the next entry.
+      if (status != Running)
+        break;
+      if (deadline.hasExpired()) {
+        stopWith(TimedOut);
+        break;
+      }
+      QString entry = entries.at(row);
+      QRegularExpressionMatchIterator i = pattern.globalMatch(entry);
+      while (i.hasNext()) {
+        QRegularExpressionMatch match = i.next();
+        found.append({ row, match.capturedStart(), match.capturedLength(),
+                       excerptOf(entry, match.capturedStart(),
+                                 match.capturedLength()) });
+      }
+    }
+
+    if (!found.isEmpty()) {
+      if (matchCount.fetch_add(found.count()) + found.count() >= maxMatches)
+        stopWith(TooManyMatches);
+      QList<Match> ready;
+      ready.swap(found);
+      emit matchesFound(ready);
+    }
+    emit progress(searched.fetch_add(row - first) + row - first, total);
+  }
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OMISEARCH_HH
+#define OMISEARCH_HH
+
+#include <QObject>
+#include <QString>
+#include <QList>
+#include <QFutureWatcher>
+#include <QRegularExpression>
+#include <QDeadlineTimer>
+#include <atomic>
+#include "omidoc.hh"
+
+// Finds every match of a pattern in a snapshot of one section, with
+// the entries split up between worker threads.  Matches are passed
+// back a chunk at a time, queued to the receiver's thread, until the
+// whole section has been searched, the search is cancelled, or it
+// runs out of time.  finished() comes from the search's own thread
+// once every worker has returned; the search must not be deleted
+// before then, but may be from anything connected to it.
+class OmiSearch : public QObject
+{
+  Q_OBJECT
+
+public:
+  struct Match
+  {
+    int row;
+    qsizetype position;
+    qsizetype length;
+    QString excerpt;
+  };
+  enum Status { Running, Finished, Cancelled, TimedOut, TooManyMatches };
+  Q_ENUM(Status)
+
+  // A timeLimit of 0 lets the search run for as long as it takes.
+  OmiSearch(const OmiDoc::Snapshot &entries, const QRegularExpression &pattern,
+            int timeLimit = 0, QObject *parent = nullptr);
+  ~OmiSearch();
+  void start();
+  void setMaxMatches(int max) { maxMatches = max; }
+
+public slots:
+  void cancel();
+
+private slots:
+  void workerFinished();
+
+signals:
+  void matchesFound(const QList<OmiSearch::Match> &matches);
+  void progress(int searched, int total);
+  void finished(OmiSearch::Status status);
+
+private:
+  OmiDoc::Snapshot entries;
+  QRegularExpression pattern;
+  int timeLimit;
+  int maxMatches;
+  QDeadlineTimer deadline;
+  std::atomic<int> status;
+  std::atomic<int> nextChunk;
+  std::atomic<int> searched;
+  std::atomic<int> matchCount;
+  int running;
+  void run();
+  void stopWith(Status);
+};
+
+Q_DECLARE_METATYPE(OmiSearch::Match)
+
+#endif
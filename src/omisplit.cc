@@ -0,0 +1,187 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "omisplit.hh"
+#include "omidoc.hh"
+#include "omiformat.hh"
+#include "omiwriter.hh"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QtConcurrent>
+
+// Fortunes are hashed this many at a time on the pool.
+const int hashChunkSize = 16384;
+
+// The fortunes that go in one shard: a run of rows when splitting by
+// bytes, or the rows picked out by hash, in order.
+struct Shard
+{
+  int first = 0;
+  int last = 0;
+  bool picked = false;
+  QList<int> rows;
+
+  int count() const { return (picked) ? rows.count() : last - first; }
+  int row(int i) const { return (picked) ? rows.at(i) : first + i; }
+};
+
+// A fortune goes to the shard its middle byte falls in, so only the
+// table is read.  With no bytes at all, they are shared out evenly.
+static QList<Shard> shardsByBytes(const OmiDoc::Snapshot &fortunes, int count)
+{
+  int entries = fortunes.count();
+  qint64 total = 0;
+  for (int i = 0; i < entries; i++)
+    total += fortunes.sizeAt(i);
+
+  QList<Shard> shards(count);
+  qint64 before = 0;
+  int shard = 0;
+  for (int i = 0; i < entries; i++) {
+    qint64 size = fortunes.sizeAt(i);
+    qint64 target = (total) ? (before + size / 2) * count / total
+      : qint64(i) * count / entries;
+    while (shard < qMin<qint64>(target, count - 1)) {
+      shards[shard].last = i;
+      shards[++shard].first = i;
+    }
+    before += size;
+  }
+  shards[shard].last = entries;
+  while (++shard < count)
+    shards[shard].first = shards[shard].last = entries;
+  return shards;
+}
+
+static QList<Shard> shardsByHash(const OmiDoc::Snapshot &fortunes, int count)
+{
+  int entries = fortunes.count();
+  QList<int> starts;
+  for (int first = 0; first < entries; first += hashChunkSize)
+    starts.append(first);
+  QList<QList<QList<int>>> chunks =
+    QtConcurrent::blockingMapped<QList<QList<QList<int>>>>(starts,
+      [&fortunes, count, entries](int first) {
+        QList<QList<int>> rows(count);
+        QByteArray buffer;
+        int last = qMin(first + hashChunkSize, entries);
+        for (int i = first; i < last; i++) {
+          QByteArrayView bytes = fortunes.utf8At(i, buffer);
+          rows[payloadDigest(bytes.data(), bytes.size()) % count].append(i);
+        }
+        return rows;
+      });
+
+  QList<Shard> shards(count);
+  for (int shard = 0; shard < count; shard++) {
+    shards[shard].picked = true;
+    for (const QList<QList<int>> &chunk : std::as_const(chunks))
+      shards[shard].rows.append(chunk.at(shard));
+  }
+  return shards;
+}
+
+static bool writeShard(const QString &filename,
+                       const OmiDoc::Snapshot &comments,
+                       const OmiDoc::Snapshot &fortunes, const Shard &shard,
+                       bool indexed)
+{
+  QFile file(filename);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    return false;
+  OmiWriter writer(&file);
+  writer.setIndexed(indexed);
+  QByteArray buffer;
+  for (int i = 0; i < comments.count(); i++)
+    if (!writer.append(OmiDoc::Comments, comments.utf8At(i, buffer)))
+      return false;
+  for (int i = 0; i < shard.count(); i++)
+    if (!writer.append(OmiDoc::Fortunes, fortunes.utf8At(shard.row(i), buffer)))
+      return false;
+  return writer.finish() >= 0;
+}
+
+OmiSplitter::OmiSplitter()
+  : partition(ByBytes), indexed(false)
+{
+}
+
+QString OmiSplitter::shardName(const QString &output, int n)
+{
+  QFileInfo info(output);
+  QString name = info.completeBaseName() + QString("-%1").arg(n);
+  if (!info.suffix().isEmpty())
+    name += "." + info.suffix();
+  return info.dir().filePath(name);
+}
+
+qint64 OmiSplitter::split(const QString &input, const QString &output,
+                          int count)
+{
+  error.clear();
+  if (count < 1) {
+    error = QString("cannot split into %1 shards").arg(count);
+    return -1;
+  }
+  if (!output.endsWith(".omi")) {
+    error = QString("shards have to be .omi files, not %1").arg(output);
+    return -1;
+  }
+  // Truncating the input would pull it out from under its mapping.
+  QString source = QFileInfo(input).canonicalFilePath();
+  for (int n = 0; n < count; n++) {
+    if (QFileInfo(shardName(output, n)).canonicalFilePath() == source) {
+      error = QString("cannot split %1 into itself").arg(input);
+      return -1;
+    }
+  }
+
+  OmiDoc doc;
+  qint64 bytesRead;
+  if (input.endsWith(".omi")) {
+    bytesRead = doc.mapFromFile(input);
+  } else {
+    QFile file(input);
+    bytesRead = doc.readFromFile(file);
+  }
+  if (bytesRead < 0) {
+    error = QString("cannot read %1").arg(input);
+    return -1;
+  }
+
+  OmiDoc::Snapshot comments = doc.snapshot(OmiDoc::Comments);
+  OmiDoc::Snapshot fortunes = doc.snapshot(OmiDoc::Fortunes);
+  QList<Shard> shards = (partition == ByHash) ? shardsByHash(fortunes, count)
+    : shardsByBytes(fortunes, count);
+
+  // Every shard has its own file and writer, so they can all be
+  // written at once.
+  QList<QFuture<bool>> futures;
+  for (int n = 0; n < count; n++)
+    futures.append(QtConcurrent::run(writeShard, shardName(output, n),
+                                     comments, fortunes, shards.at(n),
+                                     indexed));
+  qint64 written = 0;
+  for (int n = 0; n < count; n++) {
+    if (!futures[n].result() && error.isEmpty())
+      error = QString("cannot write %1").arg(shardName(output, n));
+    written += shards.at(n).count();
+  }
+  return (error.isEmpty()) ? written : -1;
+}
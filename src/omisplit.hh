@@ -0,0 +1,54 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OMISPLIT_HH
+#define OMISPLIT_HH
+
+#include <QString>
+
+// Splits the fortunes of a strfile or .omi file into a number of .omi
+// shards, for --split, writing every shard through its own OmiWriter
+// on the thread pool.  Each shard is a whole .omi file with its own
+// header and tables, and a copy of the comments.
+//
+// By bytes, the fortunes are cut into runs of about the same payload
+// size, in order, which only needs the table to plan.  By hash, a
+// fortune goes to the shard its payloadDigest() picks modulo the count,
+// so that a caller can tell where one is from its text alone.
+class OmiSplitter
+{
+public:
+  enum Partition { ByBytes, ByHash };
+
+  OmiSplitter();
+  void setPartition(Partition by) { partition = by; }
+  void setIndexed(bool on) { indexed = on; }
+  // The name of shard n: output with -n put before its suffix.
+  static QString shardName(const QString &output, int n);
+  // Returns the number of fortunes written, or -1 if the input could
+  // not be read or a shard written.
+  qint64 split(const QString &input, const QString &output, int count);
+  QString errorString() const { return error; }
+
+private:
+  Partition partition;
+  bool indexed;
+  QString error;
+};
+
+#endif
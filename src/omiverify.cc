@@ -0,0 +1,378 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "omiverify.hh"
+#include <QtAlgorithms>
+#include <QtEndian>
+#include <QtConcurrent>
+#include <QScopedPointer>
+#include <cstring>
+#include <climits>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Entries are checked on the thread pool this many at a time.
+const int verifyRangeSize = 16384;
+// Transcoded output is written out in pieces of about this size.
+const qsizetype transcodeBufferSize = 1024 * 1024;
+
+// What Windows code page 1252 has at 0x80 to 0x9f, where Latin-1 has
+// control characters.  The five holes are passed through as they are.
+static const char16_t cp1252High[32] = {
+  0x20ac, 0x0081, 0x201a, 0x0192, 0x201e, 0x2026, 0x2020, 0x2021,
+  0x02c6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008d, 0x017d, 0x008f,
+  0x0090, 0x2018, 0x2019, 0x201c, 0x201d, 0x2022, 0x2013, 0x2014,
+  0x02dc, 0x2122, 0x0161, 0x203a, 0x0153, 0x009d, 0x017e, 0x0178
+};
+
+qsizetype findInvalidUtf8(const char *data, qsizetype length)
+{
+  const uchar *s = reinterpret_cast<const uchar*>(data);
+  qsizetype i = 0;
+  while (i < length) {
+    // Most of any fortune is ASCII, so get past it a vector at a time
+    // and only look closely at the bytes with the top bit set.
+#ifdef __SSE2__
+    while (i + 16 <= length) {
+      int mask = _mm_movemask_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i)));
+      if (mask) {
+        i += qCountTrailingZeroBits(static_cast<quint32>(mask));
+        break;
+      }
+      i += 16;
+    }
+#else
+    while (i + 8 <= length) {
+      quint64 word;
+      std::memcpy(&word, s + i, sizeof(word));
+      if (word & 0x8080808080808080ULL)
+        break;
+      i += 8;
+    }
+#endif
+    if (i >= length)
+      break;
+    uchar c = s[i];
+    if (c < 0x80) {
+      i++;
+      continue;
+    }
+
+    // The well formed sequences of table 3-7 of the Unicode standard:
+    // no overlong forms, surrogates or code points past U+10FFFF.
+    int more;
+    if (c >= 0xc2 && c <= 0xdf)
+      more = 1;
+    else if (c >= 0xe0 && c <= 0xef)
+      more = 2;
+    else if (c >= 0xf0 && c <= 0xf4)
+      more = 3;
+    else
+      return i;
+    if (length - i <= more)
+      return i;
+    uchar next = s[i + 1];
+    if ((c == 0xe0 && next < 0xa0) || (c == 0xed && next > 0x9f)
+        || (c == 0xf0 && next < 0x90) || (c == 0xf4 && next > 0x8f))
+      return i;
+    for (int k = 1; k <= more; k++)
+      if ((s[i + k] & 0xc0) != 0x80)
+        return i;
+    i += more + 1;
+  }
+  return -1;
+}
+
+void appendLegacyAsUtf8(QByteArray &out, const char *data, qsizetype length,
+                        LegacyEncoding encoding)
+{
+  // Every byte comes out as at most three.
+  qsizetype at = out.size();
+  out.resize(at + 3 * length);
+  char *p = out.data() + at;
+  const uchar *s = reinterpret_cast<const uchar*>(data);
+  for (qsizetype i = 0; i < length; i++) {
+    char16_t u = s[i];
+    if (u >= 0x80 && u < 0xa0 && encoding == LegacyEncoding::Cp1252)
+      u = cp1252High[u - 0x80];
+    if (u < 0x80) {
+      *p++ = static_cast<char>(u);
+    } else if (u < 0x800) {
+      *p++ = static_cast<char>(0xc0 | (u >> 6));
+      *p++ = static_cast<char>(0x80 | (u & 0x3f));
+    } else {
+      *p++ = static_cast<char>(0xe0 | (u >> 12));
+      *p++ = static_cast<char>(0x80 | ((u >> 6) & 0x3f));
+      *p++ = static_cast<char>(0x80 | (u & 0x3f));
+    }
+  }
+  out.resize(p - out.constData());
+}
+
+OmiVerifier::OmiVerifier(const QString &filename)
+  : file(filename), data(nullptr), len(0)
+{
+}
+
+OmiVerifier::~OmiVerifier()
+{
+  if (data)
+    file.unmap(reinterpret_cast<uchar*>(const_cast<char*>(data)));
+}
+
+bool OmiVerifier::open()
+{
+  if (data || !file.open(QIODevice::ReadOnly))
+    return data != nullptr;
+  len = file.size();
+  // An empty file cannot be mapped, but then there is nothing to check.
+  if (len > 0)
+    data = reinterpret_cast<const char*>(file.map(0, len));
+  file.close();
+  return data || len == 0;
+}
+
+bool OmiVerifier::verify()
+{
+  found.clear();
+  if (!open())
+    return false;
+  if (file.fileName().endsWith(".omi"))
+    verifyOmifile();
+  else
+    verifyStrfile();
+  return true;
+}
+
+void OmiVerifier::fileProblem(qint64 offset, const QString &message)
+{
+  found.append({ OmiDoc::Fortunes, -1, offset, message });
+}
+
+QList<OmiVerifier::Span> OmiVerifier::strfileEntries() const
+{
+  // The same entries StrfileReader hands on, found the same way, but
+  // with where each one is in the file.  Blank entries are skipped so
+  // that the numbers match the rows of an opened document.
+  QList<Span> spans;
+  if (!data)
+    return spans;
+  auto add = [&spans, this](qint64 start, qint64 end) {
+    qint64 length = end - start;
+    if (length > 0 && !(length == 1 && data[start] == '\n')
+        && !(length == 2 && data[start] == '\r' && data[start + 1] == '\n'))
+      spans.append({ start, length });
+  };
+  const char *p = data;
+  const char *end = data + len;
+  qint64 start = 0;
+  while (p < end) {
+    const char *nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    const char *lineEnd = (nl) ? nl : end;
+    qint64 lineLength = lineEnd - p;
+    if ((lineLength == 1 && p[0] == '%')
+        || (lineLength == 2 && p[0] == '%' && p[1] == '\r')) {
+      add(start, p - data);
+      start = ((nl) ? nl + 1 : end) - data;
+    }
+    p = (nl) ? nl + 1 : end;
+  }
+  add(start, len);
+  return spans;
+}
+
+QList<OmiVerifier::Problem> OmiVerifier::checkSpans(const char *data,
+                                                    const QList<Span> *spans,
+                                                    int first, int last)
+{
+  QList<Problem> problems;
+  for (int i = first; i < last; i++) {
+    const Span &span = spans->at(i);
+    qsizetype bad = findInvalidUtf8(data + span.offset, span.length);
+    if (bad >= 0)
+      problems.append({ OmiDoc::Fortunes, i, span.offset + bad,
+                        QStringLiteral("not UTF-8") });
+  }
+  return problems;
+}
+
+void OmiVerifier::verifyStrfile()
+{
+  QList<Span> spans = strfileEntries();
+  QList<QFuture<QList<Problem>>> futures;
+  for (int first = 0; first < spans.count(); first += verifyRangeSize)
+    futures.append(QtConcurrent::run(checkSpans, data, &spans, first,
+                                     qMin<int>(spans.count(),
+                                               first + verifyRangeSize)));
+  for (QFuture<QList<Problem>> &future : futures)
+    found.append(future.takeResult());
+}
+
+QList<OmiVerifier::Problem> OmiVerifier::checkTable(const char *data, qint64 len,
+                                                    const OmiBlocks *blocks,
+                                                    OmiDoc::Section section,
+                                                    quint64 table, int first,
+                                                    int last, bool wide)
+{
+  QList<Problem> problems;
+  TableEntry entry;
+  qint64 limit = (blocks) ? blocks->payloadSize() : len;
+  for (int i = first; i < last; i++) {
+    copyTableEntry(&entry, data, table + i * tableEntrySize(wide), wide);
+    // An offset past the end could overflow once added to the length.
+    qint64 offset = static_cast<qint64>(qMin<quint64>(entry.offset, limit + 1));
+    qint64 end = offset + entry.length;
+    if (blocks) {
+      if (end > limit) {
+        problems.append({ section, i, offset,
+                          QStringLiteral("payload runs past the end of the blocks") });
+        continue;
+      }
+      QByteArray bytes = blocks->payload(entry.offset, entry.length);
+      if (bytes.size() != static_cast<qsizetype>(entry.length)) {
+        problems.append({ section, i, offset,
+                          QStringLiteral("compressed block is damaged") });
+        continue;
+      }
+      qsizetype bad = findInvalidUtf8(bytes.constData(), bytes.size());
+      if (bad >= 0)
+        problems.append({ section, i, offset + bad,
+                          QStringLiteral("not UTF-8") });
+    } else {
+      if (offset < omikujiHeaderSize(wide) || end > limit) {
+        problems.append({ section, i, offset,
+                          QStringLiteral("payload lies outside the file") });
+        continue;
+      }
+      qsizetype bad = findInvalidUtf8(data + offset, entry.length);
+      if (bad >= 0)
+        problems.append({ section, i, offset + bad,
+                          QStringLiteral("not UTF-8") });
+    }
+  }
+  return problems;
+}
+
+void OmiVerifier::verifyOmifile()
+{
+  if (len < omikujiHeaderSize(false)) {
+    fileProblem(0, QStringLiteral("too short for an omikuji header"));
+    return;
+  }
+  OmikujiHeader header;
+  if (!readOmikujiHeader(&header, data, len)) {
+    fileProblem(0, QStringLiteral("not an omikuji header"));
+    return;
+  }
+  bool wide = isWideVersion(header.version);
+
+  QScopedPointer<OmiBlocks> blocks;
+  if (isCompressedVersion(header.version)) {
+    BlockHeader blockHeader;
+    if (!readBlockHeader(&blockHeader, data, len, wide)) {
+      fileProblem(omikujiHeaderSize(wide),
+                  QStringLiteral("damaged block header"));
+      return;
+    }
+    blocks.reset(new OmiBlocks(data, len, blockHeader, wide));
+  }
+
+  // A file that looks as though it has a hash index should have a
+  // sound one.
+  if (len >= hashIndexTrailerSize(false)
+      && std::memcmp(data + len - 8, omikuji_index_signature, 7) == 0
+      && !OmiHashIndex().open(reinterpret_cast<const uchar*>(data), len))
+    fileProblem(len - 8, QStringLiteral("damaged hash index"));
+
+  TableEntry tables[2] = { header.commentHeader, header.fortuneHeader };
+  OmiDoc::Section sections[2] = { OmiDoc::Comments, OmiDoc::Fortunes };
+  QList<QFuture<QList<Problem>>> futures;
+  for (int t = 0; t < 2; t++) {
+    quint64 offset = tables[t].offset;
+    quint32 length = tables[t].length;
+    if (!length)
+      continue;
+    // Only the entries of a table that fit in the file can be checked.
+    qint64 entrySize = tableEntrySize(wide);
+    qint64 fit = (offset >= static_cast<quint64>(omikujiHeaderSize(wide))
+                  && offset < static_cast<quint64>(len))
+      ? (len - static_cast<qint64>(offset)) / entrySize : 0;
+    int count = static_cast<int>(qMin<qint64>(qMin<qint64>(length, fit), INT_MAX));
+    if (count < static_cast<qint64>(length))
+      found.append({ sections[t], count,
+                     static_cast<qint64>(qMin<quint64>(offset, len))
+                     + count * entrySize,
+                     QStringLiteral("table runs past the end of the file") });
+    for (int first = 0; first < count; first += verifyRangeSize)
+      futures.append(QtConcurrent::run(checkTable, data, len, blocks.data(),
+                                       sections[t], offset, first,
+                                       qMin(count, first + verifyRangeSize),
+                                       wide));
+  }
+  for (QFuture<QList<Problem>> &future : futures)
+    found.append(future.takeResult());
+}
+
+qint64 OmiVerifier::transcode(QIODevice &output, LegacyEncoding encoding)
+{
+  if (!open() || file.fileName().endsWith(".omi"))
+    return -1;
+
+  // Separators and entries that are already UTF-8 go across as they
+  // are; only the rest is converted.  The input stays mapped and the
+  // output is written as it is made.
+  QList<Span> spans = strfileEntries();
+  QByteArray buffer;
+  buffer.reserve(transcodeBufferSize + transcodeBufferSize / 2);
+  qint64 bytesOut = 0;
+  qint64 copied = 0;
+  auto flush = [&]() {
+    if (output.write(buffer) != buffer.size())
+      return false;
+    bytesOut += buffer.size();
+    buffer.resize(0);
+    return true;
+  };
+  auto copy = [&](qint64 from, qint64 to) {
+    if (to - from < transcodeBufferSize) {
+      buffer.append(data + from, to - from);
+      return true;
+    }
+    // Long runs of good entries go straight from the mapping.
+    if (!flush() || output.write(data + from, to - from) != to - from)
+      return false;
+    bytesOut += to - from;
+    return true;
+  };
+  for (const Span &span : spans) {
+    const char *entry = data + span.offset;
+    if (findInvalidUtf8(entry, span.length) < 0)
+      continue;
+    if (!copy(copied, span.offset))
+      return -1;
+    appendLegacyAsUtf8(buffer, entry, span.length, encoding);
+    copied = span.offset + span.length;
+    if (buffer.size() >= transcodeBufferSize && !flush())
+      return -1;
+  }
+  if (!copy(copied, len) || !flush())
+    return -1;
+  return bytesOut;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OMIVERIFY_HH
+#define OMIVERIFY_HH
+
+#include <QString>
+#include <QList>
+#include <QFile>
+#include <QIODevice>
+#include "omidoc.hh"
+
+// Character sets that old strfiles turn up in instead of UTF-8.
+enum class LegacyEncoding { Latin1, Cp1252 };
+
+// Where the first byte of data that is not part of well formed UTF-8
+// is, or -1 if it is all well formed.  Runs of ASCII are skipped
+// sixteen bytes at a time.
+qsizetype findInvalidUtf8(const char *data, qsizetype length);
+// Appends data, taken to be in a legacy encoding, to out as UTF-8.
+void appendLegacyAsUtf8(QByteArray &out, const char *data, qsizetype length,
+                        LegacyEncoding encoding);
+
+// Checks a whole strfile or .omi file for everything that reading it
+// would quietly paper over: a damaged header, tables or compressed
+// blocks that run off the end, entries that point outside the file,
+// and payloads that are not UTF-8.  The file is mapped and its entries
+// checked on the thread pool.
+class OmiVerifier
+{
+public:
+  struct Problem
+  {
+    // An entry of -1 is a problem with the file as a whole.
+    OmiDoc::Section section;
+    int entry;
+    // In the file, except in a compressed file, where payloads are
+    // counted from the start of the uncompressed payloads.
+    qint64 offset;
+    QString message;
+  };
+
+  explicit OmiVerifier(const QString &filename);
+  ~OmiVerifier();
+  // False if the file could not be read at all.
+  bool verify();
+  const QList<Problem> &problems() const { return found; }
+  // Writes a strfile to output with each entry that is not UTF-8
+  // taken to be in encoding and converted, and the rest of the file
+  // copied as it is.  Returns the bytes written or -1.
+  qint64 transcode(QIODevice &output, LegacyEncoding encoding);
+
+private:
+  // Where one entry's payload is.
+  struct Span
+  {
+    qint64 offset;
+    qint64 length;
+  };
+
+  QFile file;
+  const char *data;
+  qint64 len;
+  QList<Problem> found;
+  bool open();
+  QList<Span> strfileEntries() const;
+  void verifyStrfile();
+  void verifyOmifile();
+  void fileProblem(qint64, const QString&);
+  static QList<Problem> checkSpans(const char*, const QList<Span>*, int, int);
+  static QList<Problem> checkTable(const char*, qint64, const OmiBlocks*,
+                                   OmiDoc::Section, quint64, int, int, bool);
+};
+
+#endif
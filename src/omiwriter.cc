@@ -0,0 +1,101 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "omiwriter.hh"
+#include <QDataStream>
+#include <cstring>
+
+// Table entries are written out this many at a time.
+const int tableBlockSize = 512;
+
+OmiWriter::OmiWriter(QIODevice *device)
+  : device(device), start(device->pos()), offset(maxOmikujiHeaderSize),
+    indexed(false), failed(false)
+{
+  char blank[maxOmikujiHeaderSize];
+  std::memset(blank, 0, sizeof(blank));
+  failed = device->write(blank, sizeof(blank)) != maxOmikujiHeaderSize;
+}
+
+bool OmiWriter::append(int table, QByteArrayView bytes)
+{
+  if (failed)
+    return false;
+  if (device->write(bytes.data(), bytes.size()) != bytes.size()) {
+    failed = true;
+    return false;
+  }
+  TableEntry span = { static_cast<quint64>(offset),
+                      static_cast<quint32>(bytes.size()) };
+  tables[table].append(span);
+  if (indexed)
+    index.add(table, payloadDigest(bytes.data(), bytes.size()), span);
+  offset += bytes.size();
+  return true;
+}
+
+qint64 OmiWriter::finish()
+{
+  if (failed)
+    return -1;
+
+  // Everything from here on is known, so the width can be settled: an
+  // index is at most four slots an entry.
+  qint64 entries = static_cast<qint64>(tables[0].count()) + tables[1].count();
+  qint64 bound = offset + entries * tableEntrySize(false);
+  if (indexed)
+    bound += hashIndexTrailerSize(false) + (4 * entries + 4) * hashSlotSize(false);
+  bool wide = !fitsNarrowOffsets(bound);
+  qint64 entrySize = tableEntrySize(wide);
+
+  TableEntry headers[2] = { { 0, 0 }, { 0, 0 } };
+  char stored[tableBlockSize * maxTableEntrySize];
+  for (int t = 0; t < 2; t++) {
+    if (tables[t].isEmpty())
+      continue;
+    headers[t] = { static_cast<quint64>(offset),
+                   static_cast<quint32>(tables[t].count()) };
+    int used = 0;
+    for (int i = 0; i < tables[t].count(); i++) {
+      storeTableEntry(stored + used * entrySize, tables[t].at(i), wide);
+      if (++used == tableBlockSize || i == tables[t].count() - 1) {
+        if (device->write(stored, used * entrySize) != used * entrySize)
+          return -1;
+        used = 0;
+      }
+    }
+    offset += tables[t].count() * entrySize;
+  }
+  qint64 bytesOut = offset;
+  if (indexed && entries) {
+    QDataStream stream(device);
+    bytesOut += index.write(stream, offset, wide);
+    if (stream.status() != QDataStream::Ok)
+      return -1;
+  }
+
+  OmikujiHeader header;
+  fillOmikujiHeader(&header, (wide) ? omikuji_wide_version : omikuji_version,
+                    headers[0], headers[1]);
+  qint64 size = storeOmikujiHeader(stored, header);
+  qint64 end = device->pos();
+  if (!device->seek(start) || device->write(stored, size) != size
+      || !device->seek(end))
+    return -1;
+  return bytesOut;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef OMIWRITER_HH
+#define OMIWRITER_HH
+
+#include <QIODevice>
+#include <QByteArrayView>
+#include <QList>
+#include "omiformat.hh"
+#include "omihashindex.hh"
+
+// Writes an .omi file an entry at a time, for outputs that are never
+// held as a whole document.  Payloads go out as they are added, the
+// tables follow them, and the header is filled in last, once it is
+// known whether the file needs 64-bit offsets.  Room is kept for the
+// larger header, so a file with 32-bit offsets has a few unused bytes
+// before its first payload.  Tables are numbered as OmiDoc's sections.
+class OmiWriter
+{
+public:
+  // The device has to be able to go back to where it is now.
+  explicit OmiWriter(QIODevice *device);
+  // Whether the file ends with a hash index.  Set before adding.
+  void setIndexed(bool on) { indexed = on; }
+  bool append(int table, QByteArrayView bytes);
+  int count(int table) const { return tables[table].count(); }
+  // Writes the tables, the index and the header.  Returns the bytes
+  // written in all, or -1 if anything could not be written.
+  qint64 finish();
+
+private:
+  QIODevice *device;
+  qint64 start;
+  qint64 offset;
+  bool indexed;
+  bool failed;
+  QList<TableEntry> tables[2];
+  OmiHashIndexWriter index;
+};
+
+#endif
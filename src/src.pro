@@ -16,15 +16,23 @@
 # along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
 TEMPLATE = app
 TARGET = omiquji
-QT += widgets
+QT += widgets concurrent network
 DEFINES += QT_DISABLE_DEPRECATED_UP_TO=0x050F00
 
 DESTDIR=../
 
 RESOURCES = ../omiquji.qrc
-SOURCES += main.cc mainwindow.cc editdialog.cc omidoc.cc aboutdialog.cc \
-    finddialog.cc
-HEADERS += mainwindow.hh editdialog.hh omidoc.hh aboutdialog.hh \
-    finddialog.hh
+SOURCES += main.cc cli.cc mainwindow.cc editdialog.cc omidoc.cc omiblocks.cc aboutdialog.cc \
+    finddialog.cc strfilereader.cc omiformat.cc \
+    omilistmodel.cc omiloader.cc \
+    trigramindex.cc omisearch.cc fortunepicker.cc \
+    fortuneserver.cc omihashindex.cc omiverify.cc utf8arena.cc \
+    omiwriter.cc omimerge.cc omisplit.cc strfileindex.cc
+HEADERS += cli.hh mainwindow.hh editdialog.hh omidoc.hh omiblocks.hh aboutdialog.hh \
+    finddialog.hh strfilereader.hh omiformat.hh \
+    omilistmodel.hh omiloader.hh \
+    trigramindex.hh omisearch.hh fortunepicker.hh \
+    fortuneserver.hh fortuneprotocol.hh omihashindex.hh omiverify.hh utf8arena.hh \
+    omiwriter.hh omimerge.hh omisplit.hh strfileindex.hh
 FORMS   += mainwindow.ui editdialog.ui aboutdialog.ui \
     finddialog.ui
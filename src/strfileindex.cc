@@ -0,0 +1,122 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "strfileindex.hh"
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QtEndian>
+#include <climits>
+
+// The separator line between the entries of a strfile we write.
+const quint64 separatorSize = 2;
+
+QString strfileIndexName(const QString &filename) {
+  return filename + ".dat";
+}
+
+bool readStrfileIndex(const QString &filename, QList<quint64> *offsets) {
+  QFileInfo text(filename), index(strfileIndexName(filename));
+  if (!index.exists() || index.lastModified() < text.lastModified())
+    return false;
+  QFile file(index.filePath());
+  if (!file.open(QIODevice::ReadOnly))
+    return false;
+
+  char header[strfileHeaderSize];
+  if (file.read(header, strfileHeaderSize) != strfileHeaderSize)
+    return false;
+  quint32 version = qFromBigEndian<quint32>(header);
+  quint32 count = qFromBigEndian<quint32>(header + 4);
+  quint32 flags = qFromBigEndian<quint32>(header + 16);
+  if ((version != strfile_version && version != strfile_old_version)
+      || (flags & (strfileRandom | strfileOrdered | strfileRotated))
+      || header[20] != '%' || count >= INT_MAX)
+    return false;
+
+  qint64 entries = static_cast<qint64>(count) + 1;
+  qint64 rest = file.size() - strfileHeaderSize;
+  int width = (rest == entries * 4) ? 4 : (rest == entries * 8) ? 8 : 0;
+  if (!width)
+    return false;
+  QByteArray stored = file.read(rest);
+  if (stored.size() != rest)
+    return false;
+
+  QList<quint64> found(entries);
+  quint64 last = 0;
+  for (qint64 i = 0; i < entries; i++) {
+    const char *at = stored.constData() + i * width;
+    quint64 offset = (width == 4) ? qFromBigEndian<quint32>(at)
+      : qFromBigEndian<quint64>(at);
+    if (offset < last)
+      return false;
+    found[i] = last = offset;
+  }
+  if (last != static_cast<quint64>(text.size()))
+    return false;
+  *offsets = std::move(found);
+  return true;
+}
+
+bool writeStrfileIndex(const QString &filename, const QList<quint64> &offsets) {
+  QString name = strfileIndexName(filename);
+  if (offsets.isEmpty()) {
+    QFile::remove(name);
+    return false;
+  }
+
+  // fortune-mod only reads 32-bit offsets, so those are written unless
+  // the text is too big for them.
+  int width = (offsets.last() > 0xffffffff) ? 8 : 4;
+  qint64 count = offsets.count() - 1;
+  quint32 longest = 0, shortest = (count) ? UINT_MAX : 0;
+  for (qint64 i = 0; i < count; i++) {
+    quint64 length = offsets.at(i + 1) - offsets.at(i);
+    if (i + 1 < count && length >= separatorSize)
+      length -= separatorSize;
+    quint32 clamped = static_cast<quint32>(qMin<quint64>(length, UINT_MAX));
+    longest = qMax(longest, clamped);
+    shortest = qMin(shortest, clamped);
+  }
+
+  QByteArray stored(strfileHeaderSize + offsets.count() * width, '\0');
+  char *out = stored.data();
+  qToBigEndian<quint32>(strfile_version, out);
+  qToBigEndian<quint32>(static_cast<quint32>(count), out + 4);
+  qToBigEndian<quint32>(longest, out + 8);
+  qToBigEndian<quint32>(shortest, out + 12);
+  qToBigEndian<quint32>(0, out + 16);
+  out[20] = '%';
+  out += strfileHeaderSize;
+  for (quint64 offset : offsets) {
+    if (width == 4)
+      qToBigEndian<quint32>(static_cast<quint32>(offset), out);
+    else
+      qToBigEndian<quint64>(offset, out);
+    out += width;
+  }
+
+  QSaveFile file(name);
+  if (!file.open(QIODevice::WriteOnly) || file.write(stored) != stored.size()
+      || !file.commit()) {
+    QFile::remove(name);
+    return false;
+  }
+  return true;
+}
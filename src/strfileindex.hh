@@ -0,0 +1,49 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef STRFILEINDEX_HH
+#define STRFILEINDEX_HH
+
+#include <QList>
+#include <QString>
+
+// The .dat index that strfile(8) keeps next to a fortune file, with
+// where each entry starts.  Its header is five 32-bit big-endian words,
+// version, count, longest, shortest and flags, then the delimiter and
+// three bytes of padding.  One more offset than there are entries
+// follows, the last being the end of the text.  fortune-mod writes the
+// offsets as 32 bits and FreeBSD as 64, which shows in the file size.
+const quint32 strfile_version = 2;
+const quint32 strfile_old_version = 1;
+const qint64 strfileHeaderSize = 24;
+// Flags for offsets that are not in file order, or text that is rot13.
+const quint32 strfileRandom = 0x1;
+const quint32 strfileOrdered = 0x2;
+const quint32 strfileRotated = 0x4;
+
+QString strfileIndexName(const QString &filename);
+// Reads the offsets of the index of filename, if there is one that
+// still goes with it: a known version, not older than the text, in
+// file order, split on "%" lines and ending where the text does.
+bool readStrfileIndex(const QString &filename, QList<quint64> *offsets);
+// Writes or replaces the index of filename, whose entries start at
+// offsets and are separated by "%" lines.  A stale index is removed if
+// a fresh one cannot be written.
+bool writeStrfileIndex(const QString &filename, const QList<quint64> &offsets);
+
+#endif
@@ -0,0 +1,125 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "strfilereader.hh"
+#include <cstring>
+
+StrfileReader::StrfileReader(QIODevice *device, qint64 chunkSize)
+  : device(device), chunkSize(chunkSize)
+{
+}
+
+qint64 StrfileReader::read(const Sink &sink) {
+  QByteArray chunk(chunkSize, Qt::Uninitialized);
+  QByteArray entry;
+  // Where the last, possibly unfinished, line of entry begins.
+  qsizetype lineStart = 0;
+  qint64 bytesRead = 0;
+
+  while (true) {
+    qint64 n = device->read(chunk.data(), chunkSize);
+    if (n < 0) return -1;
+    if (n == 0) break;
+    bytesRead += n;
+
+    const char *p = chunk.constData();
+    const char *end = p + n;
+    while (p < end) {
+      // memchr is vectorized by any libc worth using, so let it find
+      // the line ends.  A separator is a line holding nothing but "%",
+      // which may start in an earlier chunk than the one it ends in.
+      const char *nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+      if (!nl) {
+        entry.append(p, end - p);
+        break;
+      }
+      entry.append(p, nl - p + 1);
+      p = nl + 1;
+      if (isSeparatorLine(entry.constData() + lineStart,
+                          entry.size() - lineStart - 1)) {
+        entry.truncate(lineStart);
+        if (!emitEntry(entry, sink))
+          return bytesRead;
+        // resize() rather than clear() to hang on to the capacity.
+        entry.resize(0);
+        lineStart = 0;
+      } else {
+        lineStart = entry.size();
+      }
+    }
+  }
+
+  // A trailing "%" without a newline still ends the last entry.
+  if (isSeparatorLine(entry.constData() + lineStart, entry.size() - lineStart))
+    entry.truncate(lineStart);
+  emitEntry(entry, sink);
+
+  return bytesRead;
+}
+
+bool StrfileReader::readEntry(const char *data, qsizetype length,
+                              const Sink &sink) {
+  // The separator that closes the entry, and any that open it where
+  // strfile(8) passed over blank entries.
+  qsizetype end = (length && data[length - 1] == '\n') ? length - 1 : length;
+  for (qsizetype start = qMax<qsizetype>(end - 2, 0); start < end; start++) {
+    if ((start == 0 || data[start - 1] == '\n')
+        && isSeparatorLine(data + start, end - start)) {
+      length = start;
+      break;
+    }
+  }
+  while (length) {
+    const char *nl = static_cast<const char*>(
+      std::memchr(data, '\n', qMin<qsizetype>(length, 3)));
+    if (!nl || !isSeparatorLine(data, nl - data))
+      break;
+    length -= nl - data + 1;
+    data = nl + 1;
+  }
+
+  QByteArray entry = QByteArray::fromRawData(data, length);
+  return emitEntry(entry, sink);
+}
+
+bool StrfileReader::isSeparatorLine(const char *line, qsizetype length) {
+  return (length == 1 && line[0] == '%')
+    || (length == 2 && line[0] == '%' && line[1] == '\r');
+}
+
+bool StrfileReader::emitEntry(QByteArray &entry, const Sink &sink) {
+  // Turn CRLF into LF, in place.
+  if (std::memchr(entry.constData(), '\r', entry.size())) {
+    char *out = entry.data();
+    const char *in = out;
+    const char *end = in + entry.size();
+    while (in < end) {
+      if (*in == '\r' && in + 1 < end && in[1] == '\n') {
+        in++;
+        continue;
+      }
+      *out++ = *in++;
+    }
+    entry.truncate(out - entry.constData());
+  }
+
+  // Blank entries come from doubled separators; drop them.
+  if (entry.isEmpty() || (entry.size() == 1 && entry.at(0) == '\n'))
+    return true;
+  return sink(entry.constData(), entry.size());
+}
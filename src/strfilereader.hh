@@ -0,0 +1,54 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef STRFILEREADER_HH
+#define STRFILEREADER_HH
+
+#include <QByteArray>
+#include <QIODevice>
+#include <functional>
+
+// Reads a strfile a chunk at a time and hands each entry to a sink as
+// soon as its closing "%" line turns up.  Only the current chunk and
+// the entry being assembled are held in memory.  Lines ending in CRLF
+// are accepted and passed on with plain LF endings.
+class StrfileReader
+{
+public:
+  // The sink gets the raw UTF-8 bytes of one entry and returns false
+  // to stop reading.
+  typedef std::function<bool(const char*, qsizetype)> Sink;
+
+  static const qint64 defaultChunkSize = 64 * 1024;
+
+  explicit StrfileReader(QIODevice *device,
+                         qint64 chunkSize = defaultChunkSize);
+  qint64 read(const Sink&);
+  // Hands on one entry cut out of a strfile by its offsets, as read()
+  // would.  The "%" lines strfile(8) counts in with it are dropped.
+  static bool readEntry(const char*, qsizetype, const Sink&);
+
+private:
+  QIODevice *device;
+  qint64 chunkSize;
+
+  static bool isSeparatorLine(const char*, qsizetype);
+  static bool emitEntry(QByteArray&, const Sink&);
+};
+
+#endif
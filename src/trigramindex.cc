@@ -0,0 +1,217 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "trigramindex.hh"
+#include <QtConcurrent>
+#include <algorithm>
+
+TrigramIndex::TrigramIndex(OmiDoc *doc, OmiDoc::Section section, QObject *parent)
+  : QObject(parent), doc(doc), section(section), nextId(0), deadIds(0), ready(false),
+    buildRow(0), buildTarget(0)
+{
+  connect(&builder, &QFutureWatcherBase::finished, this, &TrigramIndex::buildFinished);
+  connect(doc, &OmiDoc::reset, this, &TrigramIndex::rebuild);
+  connect(doc, &OmiDoc::entriesChanged, this, &TrigramIndex::entriesChanged);
+  connect(doc, &OmiDoc::entriesMoved, this, &TrigramIndex::entriesMoved);
+  rebuild();
+}
+
+bool TrigramIndex::lookup(const QString &text) {
+  if (!ready)
+    return false;
+  if (text == lastLookup && !candidates.isEmpty())
+    return true;
+
+  QList<quint64> wanted = trigrams(text);
+  if (wanted.isEmpty())
+    return false;
+
+  // Intersect the postings, rarest first.
+  QList<const QList<quint32>*> lists;
+  for (quint64 trigram : wanted) {
+    auto it = postings.constFind(trigram);
+    if (it == postings.constEnd()) {
+      lists.clear();
+      break;
+    }
+    lists.append(&it.value());
+  }
+  std::sort(lists.begin(), lists.end(),
+            [](const QList<quint32> *a, const QList<quint32> *b) {
+              return a->size() < b->size();
+            });
+
+  candidates = QBitArray(live.size());
+  if (!lists.isEmpty()) {
+    QList<quint32> found = *lists.first();
+    for (int i = 1; i < lists.count() && !found.isEmpty(); i++) {
+      QList<quint32> both;
+      std::set_intersection(found.cbegin(), found.cend(),
+                            lists.at(i)->cbegin(), lists.at(i)->cend(),
+                            std::back_inserter(both));
+      found.swap(both);
+    }
+    for (quint32 id : found)
+      if (live.testBit(id))
+        candidates.setBit(id);
+  }
+  lastLookup = text;
+  return true;
+}
+
+void TrigramIndex::rebuild() {
+  // A build still running is left to finish on its own; its rows are
+  // not wanted any more.
+  builder.cancel();
+  ids.clear();
+  postings.clear();
+  live.clear();
+  nextId = 0;
+  candidates.clear();
+  lastLookup.clear();
+  deadIds = 0;
+  ready = false;
+  buildRow = 0;
+  startBuild();
+}
+
+void TrigramIndex::startBuild() {
+  // The rows are read from a snapshot, so the document is free to
+  // change meanwhile, and a mapped one is decoded off the event loop.
+  OmiDoc::Snapshot entries = doc->snapshot(section);
+  buildTarget = entries.count();
+  builder.setFuture(QtConcurrent::run(&TrigramIndex::indexRows, entries,
+                                      buildRow, buildTarget));
+}
+
+void TrigramIndex::indexRows(QPromise<Postings> &promise,
+                             const OmiDoc::Snapshot &entries, int first,
+                             int last) {
+  // Each row's id is its number, which keeps the postings sorted.
+  Postings built;
+  for (int row = first; row < last; row++) {
+    if (promise.isCanceled())
+      return;
+    for (quint64 trigram : trigrams(entries.at(row)))
+      built[trigram].append(row);
+  }
+  promise.addResult(std::move(built));
+}
+
+void TrigramIndex::buildFinished() {
+  if (builder.isCanceled() || builder.future().resultCount() == 0)
+    return;
+  Postings built = builder.future().takeResult();
+  if (postings.isEmpty()) {
+    postings = std::move(built);
+  } else {
+    for (auto it = built.cbegin(); it != built.cend(); ++it)
+      postings[it.key()].append(it.value());
+  }
+  if (live.size() < buildTarget)
+    live.resize(buildTarget);
+  live.fill(true, buildRow, buildTarget);
+  ids.reserve(buildTarget);
+  for (int row = buildRow; row < buildTarget; row++)
+    ids.append(row);
+  nextId = buildTarget;
+  buildRow = buildTarget;
+
+  // Entries added while the build ran get a build of their own.
+  if (doc->entryCount(section) > buildRow)
+    startBuild();
+  else
+    ready = true;
+}
+
+void TrigramIndex::entriesChanged(OmiDoc::Section changed, int index,
+                                  int removed, int inserted) {
+  if (changed != section)
+    return;
+  if (!ready) {
+    // Rows past the snapshot being indexed are picked up once it is
+    // done; rows shifting under it mean starting again.
+    if (index >= buildTarget)
+      return;
+    rebuild();
+    return;
+  }
+
+  killIds(index, removed);
+  ids.remove(index, removed);
+  QList<quint32> added;
+  for (int row = index; row < index + inserted; row++)
+    added.append(addEntry(doc->entryAt(section, row)));
+  ids.insert(index, added.count(), 0);
+  std::copy(added.cbegin(), added.cend(), ids.begin() + index);
+  lastLookup.clear();
+
+  // Once most of the postings point at dead entries, start afresh.
+  if (deadIds > static_cast<quint32>(ids.count()))
+    rebuild();
+}
+
+void TrigramIndex::entriesMoved(OmiDoc::Section moved, int index, int count,
+                                int destination) {
+  if (moved != section)
+    return;
+  if (!ready) {
+    if (qMin(index, destination) < buildTarget)
+      rebuild();
+    return;
+  }
+  if (destination > index)
+    std::rotate(ids.begin() + index, ids.begin() + index + count,
+                ids.begin() + destination);
+  else
+    std::rotate(ids.begin() + destination, ids.begin() + index,
+                ids.begin() + index + count);
+}
+
+quint32 TrigramIndex::addEntry(const QString &text) {
+  // New ids only ever go up, so the postings stay sorted.
+  quint32 id = nextId++;
+  if (id >= static_cast<quint32>(live.size()))
+    live.resize(qMax<qsizetype>(1024, live.size() * 2));
+  live.setBit(id);
+  for (quint64 trigram : trigrams(text))
+    postings[trigram].append(id);
+  return id;
+}
+
+void TrigramIndex::killIds(int index, int count) {
+  for (int row = index; row < index + count; row++) {
+    live.clearBit(ids.at(row));
+    deadIds++;
+  }
+}
+
+QList<quint64> TrigramIndex::trigrams(const QString &text) {
+  // Trigrams of case-folded code points, 21 bits apiece.  Folding one
+  // code point at a time matches what Qt::CaseInsensitive compares.
+  QList<quint64> result;
+  QList<uint> points = text.toUcs4();
+  for (uint &point : points)
+    point = QChar::toCaseFolded(static_cast<char32_t>(point));
+  for (int i = 0; i + 2 < points.count(); i++)
+    result.append((quint64(points.at(i)) << 42) | (quint64(points.at(i + 1)) << 21)
+                  | quint64(points.at(i + 2)));
+  std::sort(result.begin(), result.end());
+  result.erase(std::unique(result.begin(), result.end()), result.end());
+  return result;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TRIGRAMINDEX_HH
+#define TRIGRAMINDEX_HH
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QBitArray>
+#include <QFutureWatcher>
+#include <QPromise>
+#include "omidoc.hh"
+
+// An inverted index from case-folded trigrams to the entries of one
+// section of an OmiDoc that contain them.  It is built from a
+// snapshot on the thread pool after a load, and kept up to date as the
+// document changes.  A lookup narrows a plain search down to the
+// entries that might match; the caller still has to check them.
+class TrigramIndex : public QObject
+{
+  Q_OBJECT
+
+public:
+  TrigramIndex(OmiDoc *doc, OmiDoc::Section section, QObject *parent = nullptr);
+
+  bool isReady() const { return ready; }
+  // Returns false when the index cannot help with text, which is the
+  // case until it is ready and for text shorter than a trigram.
+  // Otherwise mayContain() answers for each row until the next change.
+  bool lookup(const QString &text);
+  bool mayContain(int row) const { return candidates.testBit(ids.at(row)); }
+
+public slots:
+  void rebuild();
+
+private slots:
+  void buildFinished();
+  void entriesChanged(OmiDoc::Section, int, int, int);
+  void entriesMoved(OmiDoc::Section, int, int, int);
+
+private:
+  typedef QHash<quint64, QList<quint32>> Postings;
+  OmiDoc *doc;
+  OmiDoc::Section section;
+  // Entries get an id when they are indexed, so that edits only need
+  // to touch the row-to-id list and not every posting.
+  QList<quint32> ids;
+  Postings postings;
+  QBitArray live;
+  quint32 nextId;
+  quint32 deadIds;
+  QBitArray candidates;
+  QString lastLookup;
+  bool ready;
+  // Rows before buildRow are in the index; those up to buildTarget
+  // are being indexed.
+  int buildRow;
+  int buildTarget;
+  QFutureWatcher<Postings> builder;
+
+  void startBuild();
+  static void indexRows(QPromise<Postings>&, const OmiDoc::Snapshot&, int, int);
+  quint32 addEntry(const QString&);
+  void killIds(int, int);
+  static QList<quint64> trigrams(const QString&);
+};
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "utf8arena.hh"
+#include "omiformat.hh"
+
+// New chunks are at least this big, so that small entries do not each
+// cost an allocation.
+const qint64 arenaChunkSize = 1024 * 1024;
+
+void Utf8Arena::reserve(qint64 bytes)
+{
+  if (!chunks.isEmpty()
+      && chunks.last().capacity() - chunks.last().size() >= bytes)
+    return;
+  // Whatever is left at the end of the last chunk goes unused.
+  QByteArray chunk;
+  chunk.reserve(qMax(bytes, arenaChunkSize));
+  chunks.append(chunk);
+}
+
+ArenaSpan Utf8Arena::add(const char *data, qsizetype length)
+{
+  if (!length)
+    return { 0, 0, 0 };
+  reserve(length);
+  QByteArray &chunk = chunks.last();
+  ArenaSpan span = { static_cast<quint32>(chunks.count() - 1),
+                     static_cast<quint32>(chunk.size()),
+                     static_cast<quint32>(length) };
+  chunk.append(data, length);
+  held += length;
+  return span;
+}
+
+ArenaSpan Utf8Arena::add(const QString &string, QStringEncoder &encoder)
+{
+  if (string.isEmpty())
+    return { 0, 0, 0 };
+  // Encoded straight into the chunk, with room for the worst case.
+  reserve(encoder.requiredSpace(string.size()));
+  QByteArray &chunk = chunks.last();
+  qsizetype at = chunk.size();
+  appendUtf8(chunk, string, encoder);
+  ArenaSpan span = { static_cast<quint32>(chunks.count() - 1),
+                     static_cast<quint32>(at),
+                     static_cast<quint32>(chunk.size() - at) };
+  held += span.length;
+  return span;
+}
+
+void Utf8Arena::absorb(Utf8Arena &&other, QList<ArenaSpan> &spans,
+                       qsizetype first)
+{
+  quint32 base = chunks.count();
+  for (qsizetype i = first; i < spans.count(); i++)
+    if (spans.at(i).length)
+      spans[i].chunk += base;
+  chunks.append(std::move(other.chunks));
+  held += other.held;
+  other.clear();
+}
+
+void Utf8Arena::clear()
+{
+  chunks.clear();
+  held = 0;
+}
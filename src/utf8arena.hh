@@ -0,0 +1,70 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef UTF8ARENA_HH
+#define UTF8ARENA_HH
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QList>
+#include <QString>
+#include <QStringEncoder>
+
+// Where one entry's UTF-8 is in a Utf8Arena.
+struct ArenaSpan {
+  quint32 chunk;
+  quint32 offset;
+  quint32 length;
+};
+
+// The text of a document's entries, kept as UTF-8 in a few big chunks
+// rather than as a QString apiece, so that a mostly ASCII corpus takes
+// up about what it does on disk.  Bytes are only ever added, never
+// moved, so a span stays good until the arena is cleared.  Copies are
+// cheap and share the chunks, and adding to one copy leaves the bytes
+// another can see alone.
+class Utf8Arena
+{
+public:
+  Utf8Arena() : held(0) {}
+  ArenaSpan add(const char *data, qsizetype length);
+  ArenaSpan add(const QString &string, QStringEncoder &encoder);
+  // Makes room for at least bytes more in the last chunk, so that a
+  // run of entries whose size is known lands in one allocation.
+  void reserve(qint64 bytes);
+  QByteArrayView view(const ArenaSpan &span) const {
+    if (!span.length)
+      return QByteArrayView();
+    return QByteArrayView(chunks.at(span.chunk).constData() + span.offset,
+                          span.length);
+  }
+  QString string(const ArenaSpan &span) const
+    { return QString::fromUtf8(view(span)); }
+  // Takes over the chunks of other and points spans, from first on,
+  // at where their bytes end up.
+  void absorb(Utf8Arena &&other, QList<ArenaSpan> &spans, qsizetype first);
+  // All the bytes held, whether any entry still uses them or not.
+  qint64 size() const { return held; }
+  void clear();
+
+private:
+  QList<QByteArray> chunks;
+  qint64 held;
+};
+
+#endif
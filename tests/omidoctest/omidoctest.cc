@@ -0,0 +1,364 @@
+/*
+ * Copyright © 2024 Jason J.A. Stephenson <jason@sigio.com>
+ *
+ * This file is part of omiquji.
+ *
+ * omiquji is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * omiquji is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with omiquji.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QtTest>
+#include <QTemporaryDir>
+#include "omidoc.hh"
+#include "omiformat.hh"
+
+// Round trips for each form of .omi file.  Every one has to read back,
+// and map, as it was written; a delta save has to read back as a whole
+// save of the same document would; and a damaged file has to give the
+// same entries whether it is read or mapped, all of them as written.
+class OmiDocTest : public QObject
+{
+  Q_OBJECT
+
+private slots:
+  void initTestCase();
+  void roundTrip_data();
+  void roundTrip();
+  void readWide();
+  void deltaSave_data();
+  void deltaSave();
+  void damagedFile_data();
+  void damagedFile();
+
+private:
+  QTemporaryDir dir;
+  int files = 0;
+  QString newFile();
+};
+
+// Some repeats, for the deduplicating writer, and some text that is not
+// ASCII, an empty entry and a multi-line one.
+static const QStringList testComments = {
+  QStringLiteral("Made up for the tests."),
+  QStringLiteral("Ça va, ça vient."),
+};
+static const QStringList testFortunes = {
+  QStringLiteral("You will write a test today."),
+  QStringLiteral("A watched pot never boils.\n"),
+  QStringLiteral("You will write a test today."),
+  QString(),
+  QStringLiteral("大吉"),
+  QStringLiteral("Two lines\nof fortune."),
+  QStringLiteral("A watched pot never boils.\n"),
+};
+
+static void fill(OmiDoc &doc)
+{
+  QStringList comments = testComments;
+  QStringList fortunes = testFortunes;
+  doc.insertEntries(OmiDoc::Comments, 0, std::move(comments));
+  doc.insertEntries(OmiDoc::Fortunes, 0, std::move(fortunes));
+}
+
+static QStringList entriesOf(const OmiDoc &doc, OmiDoc::Section section)
+{
+  QStringList entries;
+  for (int i = 0; i < doc.entryCount(section); i++)
+    entries.append(doc.entryAt(section, i));
+  return entries;
+}
+
+static bool writeBytes(const QString &filename, const QByteArray &bytes)
+{
+  QFile file(filename);
+  return file.open(QIODevice::WriteOnly | QIODevice::Truncate)
+    && file.write(bytes) == bytes.size();
+}
+
+// OmiDoc only writes 64-bit offsets past 4 GB, so a small version 2
+// file is put together by hand: header, both tables, then payloads.
+static QByteArray wideOmifile(const QStringList &comments,
+                              const QStringList &fortunes)
+{
+  const QStringList *sections[2] = { &comments, &fortunes };
+  qint64 headerSize = omikujiHeaderSize(true);
+  qint64 entrySize = tableEntrySize(true);
+  qint64 payloadStart = headerSize
+    + (comments.count() + fortunes.count()) * entrySize;
+  QByteArray file(payloadStart, '\0');
+  QByteArray payloads;
+  char *at = file.data() + headerSize;
+  for (const QStringList *section : sections) {
+    for (const QString &entry : *section) {
+      QByteArray bytes = entry.toUtf8();
+      TableEntry span = { static_cast<quint64>(payloadStart + payloads.size()),
+                          static_cast<quint32>(bytes.size()) };
+      at += storeTableEntry(at, span, true);
+      payloads.append(bytes);
+    }
+  }
+  OmikujiHeader header;
+  TableEntry commentTable = { static_cast<quint64>(headerSize),
+                              static_cast<quint32>(comments.count()) };
+  TableEntry fortuneTable = { static_cast<quint64>(headerSize
+                                + comments.count() * entrySize),
+                              static_cast<quint32>(fortunes.count()) };
+  fillOmikujiHeader(&header, omikuji_wide_version, commentTable, fortuneTable);
+  storeOmikujiHeader(file.data(), header);
+  return file + payloads;
+}
+
+// The edits a delta save has to carry: entries added, taken away, or
+// changed in place to something of another length.
+static void applyEdit(OmiDoc &doc, const QString &edit)
+{
+  if (edit == "insert") {
+    doc.insertEntries(OmiDoc::Fortunes, 2, { QStringLiteral("Added in the middle."),
+                                             QStringLiteral("大凶") });
+    doc.insertEntries(OmiDoc::Comments, doc.commentCount(),
+                      { QStringLiteral("Added on the end.") });
+  } else if (edit == "remove") {
+    doc.removeEntries(OmiDoc::Fortunes, 1, 2);
+    doc.removeEntries(OmiDoc::Comments, 0, 1);
+  } else {
+    doc.replaceEntries(OmiDoc::Fortunes, 4,
+                       { QStringLiteral("Replaced by something longer than it was.") });
+    doc.replaceEntries(OmiDoc::Comments, 1, { QStringLiteral("Shorter.") });
+  }
+}
+
+void OmiDocTest::initTestCase()
+{
+  QVERIFY(dir.isValid());
+}
+
+QString OmiDocTest::newFile()
+{
+  return dir.filePath(QString("doc-%1.omi").arg(files++));
+}
+
+void OmiDocTest::roundTrip_data()
+{
+  QTest::addColumn<bool>("compressed");
+  QTest::addColumn<bool>("indexed");
+  QTest::addColumn<bool>("deduplicated");
+  QTest::newRow("plain") << false << false << false;
+  QTest::newRow("compressed") << true << false << false;
+  QTest::newRow("indexed") << false << true << false;
+  QTest::newRow("deduplicated") << false << false << true;
+  QTest::newRow("compressed-indexed") << true << true << false;
+  QTest::newRow("all") << true << true << true;
+}
+
+void OmiDocTest::roundTrip()
+{
+  QFETCH(bool, compressed);
+  QFETCH(bool, indexed);
+  QFETCH(bool, deduplicated);
+  QString filename = newFile();
+  {
+    OmiDoc doc;
+    fill(doc);
+    doc.setCompressed(compressed);
+    doc.setIndexed(indexed);
+    doc.setDeduplicated(deduplicated);
+    QFile file(filename);
+    QVERIFY(doc.writeToFile(file) > 0);
+  }
+
+  OmiDoc read;
+  QFile file(filename);
+  QVERIFY(read.readFromFile(file) > 0);
+  QCOMPARE(read.isCompressed(), compressed);
+  QCOMPARE(read.isIndexed(), indexed);
+  QCOMPARE(entriesOf(read, OmiDoc::Comments), testComments);
+  QCOMPARE(entriesOf(read, OmiDoc::Fortunes), testFortunes);
+
+  OmiDoc mapped;
+  QVERIFY(mapped.mapFromFile(filename) > 0);
+  QCOMPARE(mapped.isCompressed(), compressed);
+  QCOMPARE(mapped.isIndexed(), indexed);
+  QCOMPARE(entriesOf(mapped, OmiDoc::Comments), testComments);
+  QCOMPARE(entriesOf(mapped, OmiDoc::Fortunes), testFortunes);
+  for (const QString &fortune : testFortunes)
+    QVERIFY(mapped.contains(OmiDoc::Fortunes, fortune));
+  QVERIFY(!mapped.contains(OmiDoc::Fortunes, QStringLiteral("Not in there.")));
+}
+
+void OmiDocTest::readWide()
+{
+  QString filename = newFile();
+  QVERIFY(writeBytes(filename, wideOmifile(testComments, testFortunes)));
+
+  OmiDoc read;
+  QFile file(filename);
+  QVERIFY(read.readFromFile(file) > 0);
+  QCOMPARE(entriesOf(read, OmiDoc::Comments), testComments);
+  QCOMPARE(entriesOf(read, OmiDoc::Fortunes), testFortunes);
+
+  OmiDoc mapped;
+  QVERIFY(mapped.mapFromFile(filename) > 0);
+  QCOMPARE(entriesOf(mapped, OmiDoc::Comments), testComments);
+  QCOMPARE(entriesOf(mapped, OmiDoc::Fortunes), testFortunes);
+  for (const QString &fortune : testFortunes)
+    QVERIFY(mapped.contains(OmiDoc::Fortunes, fortune));
+}
+
+void OmiDocTest::deltaSave_data()
+{
+  QTest::addColumn<QString>("edit");
+  QTest::addColumn<bool>("mapped");
+  QTest::addColumn<bool>("indexed");
+  QTest::addColumn<bool>("wide");
+  const char *edits[] = { "insert", "remove", "replace" };
+  for (const char *edit : edits) {
+    QTest::newRow(qPrintable(QString("read-%1").arg(edit)))
+      << QString(edit) << false << false << false;
+    QTest::newRow(qPrintable(QString("mapped-%1").arg(edit)))
+      << QString(edit) << true << false << false;
+    QTest::newRow(qPrintable(QString("indexed-%1").arg(edit)))
+      << QString(edit) << false << true << false;
+    QTest::newRow(qPrintable(QString("wide-%1").arg(edit)))
+      << QString(edit) << false << false << true;
+  }
+}
+
+void OmiDocTest::deltaSave()
+{
+  QFETCH(QString, edit);
+  QFETCH(bool, mapped);
+  QFETCH(bool, indexed);
+  QFETCH(bool, wide);
+  QString filename = newFile();
+  if (wide) {
+    QVERIFY(writeBytes(filename, wideOmifile(testComments, testFortunes)));
+  } else {
+    OmiDoc base;
+    fill(base);
+    base.setIndexed(indexed);
+    QFile file(filename);
+    QVERIFY(base.writeToFile(file) > 0);
+  }
+  qint64 before = QFileInfo(filename).size();
+
+  OmiDoc doc;
+  if (mapped) {
+    QVERIFY(doc.mapFromFile(filename) > 0);
+  } else {
+    QFile file(filename);
+    QVERIFY(doc.readFromFile(file) > 0);
+  }
+  QCOMPARE(doc.isIndexed(), indexed);
+  applyEdit(doc, edit);
+  QStringList comments = entriesOf(doc, OmiDoc::Comments);
+  QStringList fortunes = entriesOf(doc, OmiDoc::Fortunes);
+  {
+    QFile file(filename);
+    QVERIFY(doc.writeToFile(file) > 0);
+  }
+  // A delta only ever adds to the file; a whole save after a removal
+  // would have made it smaller.
+  QVERIFY(QFileInfo(filename).size() >= before);
+
+  QString whole = newFile();
+  {
+    QFile file(whole);
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    QVERIFY(doc.writeToFile(file) > 0);
+  }
+
+  const QString saved[2] = { filename, whole };
+  for (const QString &name : saved) {
+    OmiDoc read;
+    QFile file(name);
+    QVERIFY(read.readFromFile(file) > 0);
+    QCOMPARE(entriesOf(read, OmiDoc::Comments), comments);
+    QCOMPARE(entriesOf(read, OmiDoc::Fortunes), fortunes);
+
+    OmiDoc remapped;
+    QVERIFY(remapped.mapFromFile(name) > 0);
+    QCOMPARE(remapped.isIndexed(), indexed);
+    QCOMPARE(entriesOf(remapped, OmiDoc::Comments), comments);
+    QCOMPARE(entriesOf(remapped, OmiDoc::Fortunes), fortunes);
+    for (const QString &fortune : std::as_const(fortunes))
+      QVERIFY(remapped.contains(OmiDoc::Fortunes, fortune));
+  }
+}
+
+void OmiDocTest::damagedFile_data()
+{
+  QTest::addColumn<QString>("damage");
+  QTest::newRow("short-header") << QString("short-header");
+  QTest::newRow("header-only") << QString("header-only");
+  QTest::newRow("comment-table") << QString("comment-table");
+  QTest::newRow("fortune-table") << QString("fortune-table");
+  QTest::newRow("payload") << QString("payload");
+  QTest::newRow("huge-count") << QString("huge-count");
+}
+
+void OmiDocTest::damagedFile()
+{
+  QFETCH(QString, damage);
+  QString original = newFile();
+  {
+    OmiDoc doc;
+    fill(doc);
+    QFile file(original);
+    QVERIFY(doc.writeToFile(file) > 0);
+  }
+  QFile file(original);
+  QVERIFY(file.open(QIODevice::ReadOnly));
+  QByteArray bytes = file.readAll();
+  file.close();
+  OmikujiHeader header;
+  QVERIFY(readOmikujiHeader(&header, bytes.constData(), bytes.size()));
+  TableEntry firstFortune;
+  copyTableEntry(&firstFortune, bytes.constData(), header.fortuneHeader.offset,
+                 false);
+
+  if (damage == "short-header") {
+    bytes.truncate(omikujiHeaderSize(false) / 2);
+  } else if (damage == "header-only") {
+    bytes.truncate(omikujiHeaderSize(false));
+  } else if (damage == "comment-table") {
+    bytes.truncate(header.commentHeader.offset + tableEntrySize(false) / 2);
+  } else if (damage == "fortune-table") {
+    bytes.truncate(header.fortuneHeader.offset + tableEntrySize(false) * 5 / 2);
+  } else if (damage == "payload") {
+    bytes.truncate(firstFortune.offset + firstFortune.length / 2);
+  } else {
+    // The table is said to go on far past the end of the file.
+    header.fortuneHeader.length = 0xffffffff;
+    storeOmikujiHeader(bytes.data(), header);
+  }
+  QString damaged = newFile();
+  QVERIFY(writeBytes(damaged, bytes));
+
+  OmiDoc read;
+  QFile input(damaged);
+  QVERIFY(read.readFromFile(input) >= 0);
+  OmiDoc mapped;
+  mapped.mapFromFile(damaged);
+
+  const OmiDoc::Section sections[2] = { OmiDoc::Comments, OmiDoc::Fortunes };
+  const QStringList *written[2] = { &testComments, &testFortunes };
+  for (int t = 0; t < 2; t++) {
+    QStringList entries = entriesOf(read, sections[t]);
+    QCOMPARE(entriesOf(mapped, sections[t]), entries);
+    for (int i = 0; i < qMin(entries.count(), written[t]->count()); i++)
+      QCOMPARE(entries.at(i), written[t]->at(i));
+  }
+}
+
+QTEST_GUILESS_MAIN(OmiDocTest)
+
+#include "omidoctest.moc"